@@ -8,7 +8,7 @@
  * this range.
  *
  * Basic usage:
- *   mandel [-d -i maxiter -c x0 y0 -s size -w windowsize]
+ *   mandel [-d -f -i maxiter -c x0 y0 -s size -w windowsize]
  * where
  *   maxiter denotes the maximum number of iterations at each point -- by default 1000
  *   x0, y0, and size specify the range to examine (a square
@@ -24,6 +24,8 @@
  * Additional parameters:
  *   If -h option is used, the program computes the histogram of values in the image
  *   If -o option is used, the program saves output and histogram (if computed) to file
+ *   If -f option is used, points inside the main cardioid, the period-2 bulb or with a
+ *     periodic orbit are detected and not iterated up to maxiter (same results)
  *
  * Code based on the original code from Web site for Wilkinson and Allen's
  * text on parallel programming:
@@ -46,18 +48,14 @@
 #include <X11/Xos.h>
 
 // include file and stuff to measure execution times
-#include <sys/time.h>
-double getusec_() {
-  struct timeval time;
-  gettimeofday(&time, NULL);
-  return ((double)time.tv_sec * (double)1e6 + (double)time.tv_usec);
-}
+#include "../../common/par-timing.h"
 
 double stamp;
 #define START_COUNT_TIME stamp = getusec_();
 #define STOP_COUNT_TIME(_m) stamp = getusec_() - stamp;\
                         stamp = stamp/1e6;\
-                        printf ("%s %0.6f\n",(_m), stamp);
+                        printf ("%s %0.6f\n",(_m), stamp);\
+                        par_timing_record((_m), stamp);
 
 // Default values for things
 #define N           2           /* size of problem space (x, y from -N to N) */
@@ -71,6 +69,9 @@ typedef struct {
 // Functions for GUI
 #include "mandelbrot-gui.h"     /* has setup(), interact() */
 
+// Interior detection
+#include "mandelbrot-interior.h" /* has mandel_in_cardioid(), mandel_interior() */
+
 // Global variables to output results
 // output to file
 int output2file = 0;
@@ -85,16 +86,24 @@ int setup_return;
 long min_color = 0, max_color = 0;
 double scale_color;
 double scale_real, scale_imag;
+#include "mandelbrot-display.h"  /* has display_start(), display_point(), display_stop() */
+#include "mandelbrot-image.h"    /* has image_alloc(), image_write() */
 
 // output as histogram
 int output2histogram = 0;
 int * histogram;
+#include "mandelbrot-histogram.h" /* has histogram_alloc(), histogram_add(), histogram_merge() */
 
 // dummy parameter
 int user_param = 1;
 
+// skip the iterations of points detected to be inside the set
+int interior_check = 0;
+
 void mandelbrot(int height, int width, double real_min, double imag_min,
-                double scale_real, double scale_imag, int maxiter, int **output) {
+                double scale_real, double scale_imag, int maxiter, int *output, int stride) {
+
+    if (output2display && setup_return == EXIT_SUCCESS) display_start(height, width);
 
     // Calculate points and generate appropriate output
     #pragma omp parallel
@@ -115,38 +124,36 @@ void mandelbrot(int height, int width, double real_min, double imag_min,
 
             // Calculate z0, z1, .... until divergence or maximum iterations
             int k = 0;
-            double lengthsq, temp;
-            do  {
-                temp = z.real*z.real - z.imag*z.imag + c.real;
-                z.imag = 2*z.real*z.imag + c.imag;
-                z.real = temp;
-                lengthsq = z.real*z.real + z.imag*z.imag;
-                ++k;
-            } while (lengthsq < (N*N) && k < maxiter);
+            if (interior_check) {
+                // Points inside the set return maxiter without iterating until the end
+                k = mandel_interior(c, maxiter);
+            }
+            else {
+                double lengthsq, temp;
+                do  {
+                    temp = z.real*z.real - z.imag*z.imag + c.real;
+                    z.imag = 2*z.real*z.imag + c.imag;
+                    z.real = temp;
+                    lengthsq = z.real*z.real + z.imag*z.imag;
+                    ++k;
+                } while (lengthsq < (N*N) && k < maxiter);
+            }
 
-	        output[row][col]=k;
+	        output[row*stride+col]=k;
 
             if (output2histogram)
-	        {
-            #pragma omp atomic
-            histogram[k-1]++;
-            }
+                histogram_add(k);
 		
             if (output2display) {
                 /* Scale color and display point  */
                 long color = (long) ((k-1) * scale_color) + min_color;
-                {
-                    if (setup_return == EXIT_SUCCESS) {
-                        #pragma omp critical
-                        {
-                            XSetForeground (display, gc, color);
-                            XDrawPoint (display, win, gc, col, row);
-                
-                        }
-                    }	
-                }
+                if (setup_return == EXIT_SUCCESS)
+                    display_point(row, col, color);
             }
+        }
     }
+
+    if (output2display && setup_return == EXIT_SUCCESS) display_stop();
 }
 
 int main(int argc, char *argv[]) {
@@ -158,7 +165,8 @@ int main(int argc, char *argv[]) {
     int width  = NPIXELS;         // dimensions of display window
     int height = NPIXELS;
     double size = N, x0 = 0, y0 = 0;
-    int ** output;
+    int * output;
+    int stride;
     char filename[32];
 
     // fake parallel region to delimit the start of the program (for instrumentation purposes)
@@ -173,6 +181,9 @@ int main(int argc, char *argv[]) {
 	      else if (strcmp(argv[i], "-h")==0) {
 			      output2histogram = 1;
 	      }
+	      else if (strcmp(argv[i], "-f")==0) {
+			      interior_check = 1;
+	      }
 	      else if (strcmp(argv[i], "-i")==0) {
 			      maxiter = atoi(argv[++i]);
 	      }
@@ -193,16 +204,17 @@ int main(int argc, char *argv[]) {
 	      else if (strcmp(argv[i], "-o")==0) {
                               output2file = 1;
 			      sprintf(filename, "output_omp_%d.out", omp_get_max_threads());
-    			      if((fp=fopen(filename, "wb"))==NULL) {
+    			      if((fp=fopen(filename, "w+b"))==NULL) {
 				      fprintf(stderr, "Unable to open file\n");
 				      return EXIT_FAILURE;
 			      }
 	      }
 	      else {
-		      fprintf(stderr, "Usage: %s [-o -h -d -i maxiter -w windowsize -c x0 y0 -s size]\n", argv[0]);
+		      fprintf(stderr, "Usage: %s [-o -h -d -f -i maxiter -w windowsize -c x0 y0 -s size]\n", argv[0]);
 		      fprintf(stderr, "       -o to write computed image and histogram to disk (default no file generated)\n");
 		      fprintf(stderr, "       -h to produce histogram of values in computed image (default no histogream)\n");
 		      fprintf(stderr, "       -d to display computed image (default no display)\n");
+		      fprintf(stderr, "       -f to detect points inside the set and skip their iterations (default iterate all points)\n");
 		      fprintf(stderr, "       -i to specify maximum number of iterations at each point (default 1000)\n");
 		      fprintf(stderr, "       -w to specify the size of the image to compute (default 800x800 elements)\n");
 		      fprintf(stderr, "       -c to specify the center x0+iy0 of the square to compute (default origin)\n");
@@ -224,11 +236,12 @@ int main(int argc, char *argv[]) {
             maxiter);
     fprintf(stdout, "\n");
 
-    output = malloc(height*sizeof(int *));
-    for (int row = 0; row < height; ++row)
-	    output[row] = malloc(width*sizeof(int));
+    output = image_alloc(height, width, &stride);
 
-    if (output2histogram) histogram = calloc(maxiter, sizeof(int));
+    if (output2histogram) {
+        histogram = calloc(maxiter, sizeof(int));
+        histogram_alloc(maxiter);
+    }
 
     if (output2display) {
         /* Initialize for graphical display */
@@ -254,7 +267,8 @@ int main(int argc, char *argv[]) {
         START_COUNT_TIME;
     }
 
-    mandelbrot(height, width, real_min, imag_min, scale_real, scale_imag, maxiter, output);
+    mandelbrot(height, width, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+    if (output2histogram) histogram_merge(maxiter);
 
     // End timing
     if (!output2display) {
@@ -271,8 +285,7 @@ int main(int argc, char *argv[]) {
 
     if ((output2file) && (fp != NULL)) {
         fprintf(stdout, "Writing output file to disk: %s\n", filename);
-        for (int row = 0; row < height; ++row)
-            if(fwrite(output[row], sizeof(int), width, fp) != width)
+        if (!image_write(fp, height, width, stride, output))
 	        fprintf(stderr, "Error when writing output to file\n");
         if (output2histogram)
             if(fwrite(histogram, sizeof(int), maxiter, fp) != maxiter)
@@ -8,7 +8,7 @@
  * this range.
  *
  * Basic usage:
- *   mandel [-d -i maxiter -c x0 y0 -s size -w windowsize]
+ *   mandel [-d -f -t -b -i maxiter -c x0 y0 -s size -w windowsize]
  * where
  *   maxiter denotes the maximum number of iterations at each point -- by default 1000
  *   x0, y0, and size specify the range to examine (a square
@@ -24,6 +24,12 @@
  * Additional parameters:
  *   If -h option is used, the program computes the histogram of values in the image
  *   If -o option is used, the program saves output and histogram (if computed) to file
+ *   If -f option is used, points inside the main cardioid, the period-2 bulb or with a
+ *     periodic orbit are detected and not iterated up to maxiter (same results)
+ *   If -t option is used, the points are computed by a tiled work-stealing scheduler
+ *     instead of one task per point
+ *   If -b option is used, the image is computed by recursive subdivision (Mariani-Silver),
+ *     filling the rectangles with a uniform border without computing their points
  *
  * Code based on the original code from Web site for Wilkinson and Allen's
  * text on parallel programming:
@@ -37,6 +43,7 @@
 #include <math.h>
 #include <unistd.h>
 #include <malloc.h>
+#include <sched.h>
 
 #include "omp.h"
 
@@ -46,18 +53,14 @@
 #include <X11/Xos.h>
 
 // include file and stuff to measure execution times
-#include <sys/time.h>
-double getusec_() {
-  struct timeval time;
-  gettimeofday(&time, NULL);
-  return ((double)time.tv_sec * (double)1e6 + (double)time.tv_usec);
-}
+#include "../../common/par-timing.h"
 
 double stamp;
 #define START_COUNT_TIME stamp = getusec_();
 #define STOP_COUNT_TIME(_m) stamp = getusec_() - stamp;\
                         stamp = stamp/1e6;\
-                        printf ("%s %0.6f\n",(_m), stamp);
+                        printf ("%s %0.6f\n",(_m), stamp);\
+                        par_timing_record((_m), stamp);
 
 // Default values for things
 #define N           2           /* size of problem space (x, y from -N to N) */
@@ -71,6 +74,9 @@ typedef struct {
 // Functions for GUI
 #include "mandelbrot-gui.h"     /* has setup(), interact() */
 
+// Interior detection
+#include "mandelbrot-interior.h" /* has mandel_in_cardioid(), mandel_interior() */
+
 // Global variables to output results
 // output to file
 int output2file = 0;
@@ -85,24 +91,44 @@ int setup_return;
 long min_color = 0, max_color = 0;
 double scale_color;
 double scale_real, scale_imag;
+#include "mandelbrot-display.h"  /* has display_start(), display_point(), display_stop() */
+#include "mandelbrot-image.h"    /* has image_alloc(), image_write() */
 
 // output as histogram
 int output2histogram = 0;
 int * histogram;
+#include "mandelbrot-histogram.h" /* has histogram_alloc(), histogram_add(), histogram_merge() */
 
 // dummy parameter
 int user_param = 1;
 
-void mandelbrot(int height, int width, double real_min, double imag_min,
-                double scale_real, double scale_imag, int maxiter, int **output) {
+// skip the iterations of points detected to be inside the set
+int interior_check = 0;
 
-    // Calculate points and generate appropriate output
-    #pragma omp parallel
-    #pragma omp single
-    for (int row = 0; row < height; ++row) {
-        for (int col = 0; col < width; ++col) {
-            #pragma omp task firstprivate(row, col)
-            {
+// use the tiled work-stealing scheduler instead of one task per point
+int tiled = 0;
+
+// use the Mariani-Silver engine instead of one task per point
+int tracing = 0;
+
+// Store the number of iterations k of point (row, col) and generate appropriate output
+static inline void mandel_store(int row, int col, int k, int *output, int stride) {
+	        output[row*stride+col]=k;
+
+            if (output2histogram)
+                histogram_add(k);
+		
+            if (output2display) {
+                /* Scale color and display point  */
+                long color = (long) ((k-1) * scale_color) + min_color;
+                if (setup_return == EXIT_SUCCESS)
+                    display_point(row, col, color);
+            }
+}
+
+// Compute point (row, col) and generate appropriate output, returns its number of iterations
+static inline int mandel_point(int row, int col, int height, double real_min, double imag_min,
+                               double scale_real, double scale_imag, int maxiter, int *output, int stride) {
             complex z, c;
 
             z.real = z.imag = 0;
@@ -116,39 +142,307 @@ void mandelbrot(int height, int width, double real_min, double imag_min,
 
             // Calculate z0, z1, .... until divergence or maximum iterations
             int k = 0;
-            double lengthsq, temp;
-            do  {
-                temp = z.real*z.real - z.imag*z.imag + c.real;
-                z.imag = 2*z.real*z.imag + c.imag;
-                z.real = temp;
-                lengthsq = z.real*z.real + z.imag*z.imag;
-                ++k;
-            } while (lengthsq < (N*N) && k < maxiter);
+            if (interior_check) {
+                // Points inside the set return maxiter without iterating until the end
+                k = mandel_interior(c, maxiter);
+            }
+            else {
+                double lengthsq, temp;
+                do  {
+                    temp = z.real*z.real - z.imag*z.imag + c.real;
+                    z.imag = 2*z.real*z.imag + c.imag;
+                    z.real = temp;
+                    lengthsq = z.real*z.real + z.imag*z.imag;
+                    ++k;
+                } while (lengthsq < (N*N) && k < maxiter);
+            }
+
+            mandel_store(row, col, k, output, stride);
+            return k;
+}
 
-	        output[row][col]=k;
+// Tiled work-stealing scheduler
+//
+// The image is dealt as a grid of about TILES_PER_THREAD tiles per thread to
+// per-thread deques. Each thread pops tiles from the bottom of its own deque
+// and computes them row by row. Whenever some thread runs out of work, the
+// rest of the tile being computed is split in half and the second half is
+// pushed to the deque, so tiles that turn out to be expensive (close to the
+// border of the set) are divided until all threads are busy. Idle threads
+// steal the oldest tile from the deque with the most expensive queued work,
+// and yield the core after STEAL_SPIN failed attempts.
+#define TILES_PER_THREAD 4
+#define STEAL_SPIN 1000
 
-            if (output2histogram)
-	        {
-            #pragma omp atomic
-            histogram[k-1]++;
+typedef struct {
+    int row, col, rows, cols;
+} tile;
+
+typedef struct {
+    omp_lock_t lock;
+    tile *tiles;                // circular buffer, tiles in [top, bottom)
+    long top, bottom, capacity;
+    long queued;                // pixels in the queued tiles
+    double cost;                // iterations per pixel of the last tile computed by the owner
+} __attribute__ ((aligned (64))) tile_deque;
+
+long pixels_left;               // pixels not computed yet
+int threads_idle;               // threads looking for a tile to steal
+
+static void push_tile(tile_deque *q, tile t) {
+    omp_set_lock(&q->lock);
+    q->tiles[q->bottom % q->capacity] = t;
+    q->bottom++;
+    q->queued += (long) t.rows * t.cols;
+    omp_unset_lock(&q->lock);
+}
+
+static int pop_tile(tile_deque *q, tile *t) {
+    int found = 0;
+    omp_set_lock(&q->lock);
+    if (q->top < q->bottom) {
+        q->bottom--;
+        *t = q->tiles[q->bottom % q->capacity];
+        q->queued -= (long) t->rows * t->cols;
+        found = 1;
+    }
+    omp_unset_lock(&q->lock);
+    return found;
+}
+
+static int steal_tile(tile_deque *deques, int nthreads, int me, tile *t) {
+    // Look for the victim with the most expensive queued work
+    int victim = -1;
+    double best = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        long queued;
+        double cost;
+        if (i == me) continue;
+        #pragma omp atomic read
+        queued = deques[i].queued;
+        #pragma omp atomic read
+        cost = deques[i].cost;
+        if (queued * (cost + 1) > best) {
+            best = queued * (cost + 1);
+            victim = i;
+        }
+    }
+    if (victim < 0) return 0;
+
+    int found = 0;
+    tile_deque *q = &deques[victim];
+    omp_set_lock(&q->lock);
+    if (q->top < q->bottom) {
+        *t = q->tiles[q->top % q->capacity];
+        q->top++;
+        q->queued -= (long) t->rows * t->cols;
+        found = 1;
+    }
+    omp_unset_lock(&q->lock);
+    return found;
+}
+
+void mandelbrot_tiled(int height, int width, double real_min, double imag_min,
+                      double scale_real, double scale_imag, int maxiter, int *output, int stride) {
+    int nthreads = omp_get_max_threads();
+    int ntiles = (int) ceil(sqrt((double) TILES_PER_THREAD * nthreads));
+    int tile_rows = (height + ntiles - 1) / ntiles;
+    int tile_cols = (width + ntiles - 1) / ntiles;
+
+    // Tiles are disjoint and at least one row high, so no more than
+    // height*ntiles of them can be queued at any time
+    tile_deque *deques = aligned_alloc(64, nthreads * sizeof(tile_deque));
+    for (int i = 0; i < nthreads; ++i) {
+        omp_init_lock(&deques[i].lock);
+        deques[i].capacity = (long) height * ntiles;
+        deques[i].tiles = malloc(deques[i].capacity * sizeof(tile));
+        deques[i].top = deques[i].bottom = 0;
+        deques[i].queued = 0;
+        deques[i].cost = 0;
+    }
+    pixels_left = (long) height * width;
+    threads_idle = 0;
+
+    #pragma omp parallel num_threads(nthreads)
+    {
+        int me = omp_get_thread_num();
+        tile t;
+
+        // The team may be smaller than nthreads (dynamic adjustment, thread
+        // limits), so the tiles are only dealt to the deques of its threads
+        #pragma omp single
+        {
+            int next = 0;
+            for (int row = 0; row < height; row += tile_rows)
+                for (int col = 0; col < width; col += tile_cols) {
+                    tile t = { row, col, (height - row < tile_rows) ? height - row : tile_rows,
+                                         (width - col < tile_cols) ? width - col : tile_cols };
+                    push_tile(&deques[next++ % omp_get_num_threads()], t);
+                }
+        }
+
+        while (1) {
+            long left = 1;
+            if (!pop_tile(&deques[me], &t)) {
+                #pragma omp atomic
+                threads_idle++;
+                int spins = 0;
+                while (!steal_tile(deques, omp_get_num_threads(), me, &t)) {
+                    #pragma omp atomic read
+                    left = pixels_left;
+                    if (left == 0) break;
+                    if (++spins == STEAL_SPIN) {
+                        sched_yield();
+                        spins = 0;
+                    }
+                }
+                #pragma omp atomic
+                threads_idle--;
+                if (left == 0) break;
             }
-		
-            if (output2display) {
-                /* Scale color and display point  */
-                long color = (long) ((k-1) * scale_color) + min_color;
-                {
-                    if (setup_return == EXIT_SUCCESS) {
-                        #pragma omp critical
-                        {
-                            XSetForeground (display, gc, color);
-                            XDrawPoint (display, win, gc, col, row);
-                
-                        }
-                    }	
+
+            long iters = 0;
+            for (int r = 0; r < t.rows; ++r) {
+                for (int col = t.col; col < t.col + t.cols; ++col)
+                    iters += mandel_point(t.row + r, col, height, real_min, imag_min,
+                                          scale_real, scale_imag, maxiter, output, stride);
+
+                // Give away half of the rest of the tile if some thread is idle
+                int idle, rest = t.rows - r - 1;
+                #pragma omp atomic read
+                idle = threads_idle;
+                if (idle > 0 && rest >= 2) {
+                    tile half = { t.row + r + 1 + rest/2, t.col, rest - rest/2, t.cols };
+                    push_tile(&deques[me], half);
+                    t.rows -= half.rows;
                 }
             }
+
+            #pragma omp atomic write
+            deques[me].cost = (double) iters / ((long) t.rows * t.cols);
+            #pragma omp atomic
+            pixels_left -= (long) t.rows * t.cols;
+        }
+    }
+
+    for (int i = 0; i < nthreads; ++i) {
+        omp_destroy_lock(&deques[i].lock);
+        free(deques[i].tiles);
+    }
+    free(deques);
+}
+
+// Mariani-Silver engine
+//
+// If all the points on the border of a rectangle have the same number of
+// iterations, the inside of the rectangle is filled with that number without
+// computing it. Otherwise its middle row and column are computed, completing
+// the borders of its four quarters, and each quarter is processed the same way
+// in a new task, with a cut-off in the recursion level to stop generating
+// tasks as in the multisort programs. Rectangles with TRACING_MIN_SIZE or less
+// rows or columns inside are computed point by point.
+//
+// Since the set is connected, a uniform border almost always encloses a
+// uniform region; filaments thinner than the smallest rectangles may be lost.
+#define TRACING_MIN_SIZE 4
+#define TRACING_CUTOFF   8
+
+// The points on the border of the rectangle rows r0..r1, columns c0..c1 are already computed
+void mandel_rect(int r0, int c0, int r1, int c1, int d, int height, double real_min, double imag_min,
+                 double scale_real, double scale_imag, int maxiter, int *output, int stride) {
+    int k = output[r0*stride+c0];
+    int uniform = 1;
+    for (int col = c0; col <= c1 && uniform; ++col)
+        uniform = (output[r0*stride+col] == k) && (output[r1*stride+col] == k);
+    for (int row = r0+1; row < r1 && uniform; ++row)
+        uniform = (output[row*stride+c0] == k) && (output[row*stride+c1] == k);
+
+    if (uniform) {
+        for (int row = r0+1; row < r1; ++row)
+            for (int col = c0+1; col < c1; ++col)
+                mandel_store(row, col, k, output, stride);
+    } else if (r1-r0-1 <= TRACING_MIN_SIZE || c1-c0-1 <= TRACING_MIN_SIZE) {
+        // Base case
+        for (int row = r0+1; row < r1; ++row)
+            for (int col = c0+1; col < c1; ++col)
+                mandel_point(row, col, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+    } else {
+        // Middle row and column, the borders of the four quarters
+        int rm = (r0 + r1) / 2, cm = (c0 + c1) / 2;
+        for (int col = c0+1; col < c1; ++col)
+            mandel_point(rm, col, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+        for (int row = r0+1; row < r1; ++row)
+            if (row != rm)
+                mandel_point(row, cm, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+
+        // Recursive decomposition, quarters only read their own border
+        // so there is no need to wait for them
+        if (!omp_in_final()) {
+            #pragma omp task final (d >= TRACING_CUTOFF)
+            mandel_rect(r0, c0, rm, cm, d+1, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+            #pragma omp task final (d >= TRACING_CUTOFF)
+            mandel_rect(r0, cm, rm, c1, d+1, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+            #pragma omp task final (d >= TRACING_CUTOFF)
+            mandel_rect(rm, c0, r1, cm, d+1, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+            #pragma omp task final (d >= TRACING_CUTOFF)
+            mandel_rect(rm, cm, r1, c1, d+1, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+        }
+        else {
+            mandel_rect(r0, c0, rm, cm, d+1, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+            mandel_rect(r0, cm, rm, c1, d+1, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+            mandel_rect(rm, c0, r1, cm, d+1, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+            mandel_rect(rm, cm, r1, c1, d+1, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+        }
+    }
+}
+
+void mandelbrot_tracing(int height, int width, double real_min, double imag_min,
+                        double scale_real, double scale_imag, int maxiter, int *output, int stride) {
+    #pragma omp parallel
+    #pragma omp single
+    {
+        // Border of the whole image
+        #pragma omp taskloop
+        for (int col = 0; col < width; ++col) {
+            mandel_point(0, col, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+            if (height > 1)
+                mandel_point(height-1, col, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+        }
+        #pragma omp taskloop
+        for (int row = 1; row < height-1; ++row) {
+            mandel_point(row, 0, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+            if (width > 1)
+                mandel_point(row, width-1, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+        }
+
+        mandel_rect(0, 0, height-1, width-1, 0, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+    }
+}
+
+void mandelbrot(int height, int width, double real_min, double imag_min,
+                double scale_real, double scale_imag, int maxiter, int *output, int stride) {
+
+    if (output2display && setup_return == EXIT_SUCCESS) display_start(height, width);
+
+    if (tiled) {
+        mandelbrot_tiled(height, width, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+    }
+    else if (tracing) {
+        mandelbrot_tracing(height, width, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+    }
+    else {
+        // Calculate points and generate appropriate output
+        #pragma omp parallel
+        #pragma omp single
+        for (int row = 0; row < height; ++row) {
+            for (int col = 0; col < width; ++col) {
+                #pragma omp task firstprivate(row, col)
+                mandel_point(row, col, height, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
             }
+        }
     }
+
+    if (output2display && setup_return == EXIT_SUCCESS) display_stop();
 }
 
 int main(int argc, char *argv[]) {
@@ -160,7 +454,8 @@ int main(int argc, char *argv[]) {
     int width  = NPIXELS;         // dimensions of display window
     int height = NPIXELS;
     double size = N, x0 = 0, y0 = 0;
-    int ** output;
+    int * output;
+    int stride;
     char filename[32];
 
     // fake parallel region to delimit the start of the program (for instrumentation purposes)
@@ -175,6 +470,15 @@ int main(int argc, char *argv[]) {
 	      else if (strcmp(argv[i], "-h")==0) {
 			      output2histogram = 1;
 	      }
+	      else if (strcmp(argv[i], "-t")==0) {
+			      tiled = 1;
+	      }
+	      else if (strcmp(argv[i], "-f")==0) {
+			      interior_check = 1;
+	      }
+	      else if (strcmp(argv[i], "-b")==0) {
+			      tracing = 1;
+	      }
 	      else if (strcmp(argv[i], "-i")==0) {
 			      maxiter = atoi(argv[++i]);
 	      }
@@ -195,16 +499,19 @@ int main(int argc, char *argv[]) {
 	      else if (strcmp(argv[i], "-o")==0) {
                               output2file = 1;
 			      sprintf(filename, "output_omp_%d.out", omp_get_max_threads());
-    			      if((fp=fopen(filename, "wb"))==NULL) {
+    			      if((fp=fopen(filename, "w+b"))==NULL) {
 				      fprintf(stderr, "Unable to open file\n");
 				      return EXIT_FAILURE;
 			      }
 	      }
 	      else {
-		      fprintf(stderr, "Usage: %s [-o -h -d -i maxiter -w windowsize -c x0 y0 -s size]\n", argv[0]);
+		      fprintf(stderr, "Usage: %s [-o -h -d -f -t -b -i maxiter -w windowsize -c x0 y0 -s size]\n", argv[0]);
 		      fprintf(stderr, "       -o to write computed image and histogram to disk (default no file generated)\n");
 		      fprintf(stderr, "       -h to produce histogram of values in computed image (default no histogream)\n");
 		      fprintf(stderr, "       -d to display computed image (default no display)\n");
+		      fprintf(stderr, "       -f to detect points inside the set and skip their iterations (default iterate all points)\n");
+		      fprintf(stderr, "       -t to compute the image with the tiled work-stealing scheduler (default one task per point)\n");
+		      fprintf(stderr, "       -b to compute the image by recursive subdivision of rectangles (default one task per point)\n");
 		      fprintf(stderr, "       -i to specify maximum number of iterations at each point (default 1000)\n");
 		      fprintf(stderr, "       -w to specify the size of the image to compute (default 800x800 elements)\n");
 		      fprintf(stderr, "       -c to specify the center x0+iy0 of the square to compute (default origin)\n");
@@ -212,6 +519,10 @@ int main(int argc, char *argv[]) {
         	      return EXIT_FAILURE;
 	      }
     }
+    if (tiled && tracing) {
+        fprintf(stderr, "-t and -b are different ways to compute the image, use only one of them\n");
+        return EXIT_FAILURE;
+    }
     real_min = x0 - size;
     real_max = x0 + size;
     imag_min = y0 - size;
@@ -226,11 +537,12 @@ int main(int argc, char *argv[]) {
             maxiter);
     fprintf(stdout, "\n");
 
-    output = malloc(height*sizeof(int *));
-    for (int row = 0; row < height; ++row)
-	    output[row] = malloc(width*sizeof(int));
+    output = image_alloc(height, width, &stride);
 
-    if (output2histogram) histogram = calloc(maxiter, sizeof(int));
+    if (output2histogram) {
+        histogram = calloc(maxiter, sizeof(int));
+        histogram_alloc(maxiter);
+    }
 
     if (output2display) {
         /* Initialize for graphical display */
@@ -256,7 +568,8 @@ int main(int argc, char *argv[]) {
         START_COUNT_TIME;
     }
 
-    mandelbrot(height, width, real_min, imag_min, scale_real, scale_imag, maxiter, output);
+    mandelbrot(height, width, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+    if (output2histogram) histogram_merge(maxiter);
 
     // End timing
     if (!output2display) {
@@ -273,8 +586,7 @@ int main(int argc, char *argv[]) {
 
     if ((output2file) && (fp != NULL)) {
         fprintf(stdout, "Writing output file to disk: %s\n", filename);
-        for (int row = 0; row < height; ++row)
-            if(fwrite(output[row], sizeof(int), width, fp) != width)
+        if (!image_write(fp, height, width, stride, output))
 	        fprintf(stderr, "Error when writing output to file\n");
         if (output2histogram)
             if(fwrite(histogram, sizeof(int), maxiter, fp) != maxiter)
@@ -8,7 +8,7 @@
  * this range.
  *
  * Basic usage:
- *   mandel [-d -i maxiter -c x0 y0 -s size -w windowsize]
+ *   mandel [-d -f -p -i maxiter -c x0 y0 -s size -w windowsize]
  * where
  *   maxiter denotes the maximum number of iterations at each point -- by default 1000
  *   x0, y0, and size specify the range to examine (a square
@@ -24,6 +24,10 @@
  * Additional parameters:
  *   If -h option is used, the program computes the histogram of values in the image
  *   If -o option is used, the program saves output and histogram (if computed) to file
+ *   If -f option is used, points inside the main cardioid, the period-2 bulb or with a
+ *     periodic orbit are detected and not iterated up to maxiter (same results)
+ *   If -p option is used, points are computed by perturbation of a reference orbit
+ *     at the center, for deep zooms (small size) where double precision is not enough
  *
  * Code based on the original code from Web site for Wilkinson and Allen's
  * text on parallel programming:
@@ -46,18 +50,14 @@
 #include <X11/Xos.h>
 
 // include file and stuff to measure execution times
-#include <sys/time.h>
-double getusec_() {
-  struct timeval time;
-  gettimeofday(&time, NULL);
-  return ((double)time.tv_sec * (double)1e6 + (double)time.tv_usec);
-}
+#include "../../common/par-timing.h"
 
 double stamp;
 #define START_COUNT_TIME stamp = getusec_();
 #define STOP_COUNT_TIME(_m) stamp = getusec_() - stamp;\
                         stamp = stamp/1e6;\
-                        printf ("%s %0.6f\n",(_m), stamp);
+                        printf ("%s %0.6f\n",(_m), stamp);\
+                        par_timing_record((_m), stamp);
 
 // Default values for things
 #define N           2           /* size of problem space (x, y from -N to N) */
@@ -71,6 +71,18 @@ typedef struct {
 // Functions for GUI
 #include "mandelbrot-gui.h"     /* has setup(), interact() */
 
+// Interior detection
+#include "mandelbrot-interior.h" /* has mandel_in_cardioid(), mandel_interior() */
+
+// SIMD kernel to compute several points of a row at once
+#include "mandelbrot-simd.h"     /* has mandel_simd() */
+
+// Perturbation engine for deep zooms
+#include "mandelbrot-perturbation.h" /* has dd_parse(), perturbation_reference(), perturbation_point() */
+
+// Tile cache for zoom and pan
+#include "mandelbrot-tiles.h"    /* has tiles_open(), tiles_snap(), tiles_on_lattice(), tiles_render() */
+
 // Global variables to output results
 // output to file
 int output2file = 0;
@@ -85,68 +97,98 @@ int setup_return;
 long min_color = 0, max_color = 0;
 double scale_color;
 double scale_real, scale_imag;
+#include "mandelbrot-display.h"  /* has display_start(), display_point(), display_stop() */
+#include "mandelbrot-image.h"    /* has image_alloc(), image_write() */
 
 // output as histogram
 int output2histogram = 0;
 int * histogram;
+#include "mandelbrot-histogram.h" /* has histogram_alloc(), histogram_add(), histogram_merge() */
 
 // dummy parameter
 int user_param = 1;
 
+// skip the iterations of points detected to be inside the set
+int interior_check = 0;
+
+// compute the points by perturbation of a reference orbit
+int perturbation = 0;
+
+// reuse the tiles computed by previous calls to mandelbrot()
+int tile_cache = 0;
+
 void mandelbrot(int height, int width, double real_min, double imag_min,
-                double scale_real, double scale_imag, int maxiter, int **output) {
+                double scale_real, double scale_imag, int maxiter, int *output, int stride) {
+
+    if (output2display && setup_return == EXIT_SUCCESS) display_start(height, width);
+
+    // Images on the lattice of the tile cache are assembled from its tiles
+    int level;
+    if (tile_cache && !perturbation && tiles_on_lattice(real_min, imag_min, scale_real, scale_imag, &level)) {
+        tiles_render(level, lround(real_min / scale_real), lround(imag_min / scale_imag),
+                     width, height, maxiter, interior_check, output, stride);
+
+        #pragma omp parallel for schedule(static)
+        for (int row = 0; row < height; ++row)
+            for (int col = 0; col < width; ++col) {
+                int k = output[row*stride+col];
+                if (output2histogram)
+                    histogram_add(k);
+                if (output2display && setup_return == EXIT_SUCCESS)
+                    display_point(row, col, (long) ((k-1) * scale_color) + min_color);
+            }
+
+        if (output2display && setup_return == EXIT_SUCCESS) display_stop();
+        return;
+    }
+
+    if (perturbation) {
+        // Reference orbit at the center, series valid up to the corners of the image
+        double radius = 0.5 * sqrt((width*scale_real)*(width*scale_real) + (height*scale_imag)*(height*scale_imag));
+        perturbation_reference(maxiter, radius);
+    }
 
     // Calculate points and generate appropriate output
     #pragma omp parallel
     #pragma omp single
   	#pragma omp taskloop
     for (int row = 0; row < height; ++row) {
-        for (int col = 0; col < width; ++col) {
-            complex z, c;
-
-            z.real = z.imag = 0;
-
-            /* Scale display coordinates to actual region  */
-            c.real = real_min + ((double) col * scale_real);
-            c.imag = imag_min + ((double) (height-1-row) * scale_imag);
-                                        /* height-1-row so y axis displays
-                                         * with larger values at top
-                                         */
-
-            // Calculate z0, z1, .... until divergence or maximum iterations
-            int k = 0;
-            double lengthsq, temp;
-            do  {
-                temp = z.real*z.real - z.imag*z.imag + c.real;
-                z.imag = 2*z.real*z.imag + c.imag;
-                z.real = temp;
-                lengthsq = z.real*z.real + z.imag*z.imag;
-                ++k;
-            } while (lengthsq < (N*N) && k < maxiter);
-
-	    output[row][col]=k;
+        double c_imag = imag_min + ((double) (height-1-row) * scale_imag);
+                                    /* height-1-row so y axis displays
+                                     * with larger values at top
+                                     */
+
+        for (int col0 = 0; col0 < width; col0 += MANDEL_LANES) {
+            // Calculate MANDEL_LANES adjacent points of the row at once
+            int kv[MANDEL_LANES];
+            if (perturbation) {
+                // offsets of the points from the center
+                double dci = ((double) (height-1-row) - 0.5*height) * scale_imag;
+                for (int l = 0; l < MANDEL_LANES && col0 + l < width; ++l)
+                    kv[l] = perturbation_point(((double) (col0+l) - 0.5*width) * scale_real, dci, maxiter);
+            }
+            else
+                mandel_simd(col0, c_imag, real_min, scale_real, maxiter, interior_check, kv);
+
+            for (int col = col0; col < width && col < col0 + MANDEL_LANES; ++col) {
+            int k = kv[col-col0];
+
+	        output[row*stride+col]=k;
 
             if (output2histogram)
-	        {
-            #pragma omp atomic
-            histogram[k-1]++;
-            }
+                histogram_add(k);
 		
             if (output2display) {
                 /* Scale color and display point  */
- 		    long color = (long) ((k-1) * scale_color) + min_color;
-		
-		        if (setup_return == EXIT_SUCCESS) {
-			    #pragma omp critical
-			    {
-				    XSetForeground (display, gc, color);
-				    XDrawPoint (display, win, gc, col, row);
-		
-		        }
-			
+                long color = (long) ((k-1) * scale_color) + min_color;
+                if (setup_return == EXIT_SUCCESS)
+                    display_point(row, col, color);
             }
             }
+        }
     }
+
+    if (output2display && setup_return == EXIT_SUCCESS) display_stop();
 }
 
 int main(int argc, char *argv[]) {
@@ -158,7 +200,8 @@ int main(int argc, char *argv[]) {
     int width  = NPIXELS;         // dimensions of display window
     int height = NPIXELS;
     double size = N, x0 = 0, y0 = 0;
-    int ** output;
+    int * output;
+    int stride;
     char filename[32];
 
     // fake parallel region to delimit the start of the program (for instrumentation purposes)
@@ -173,6 +216,12 @@ int main(int argc, char *argv[]) {
 	      else if (strcmp(argv[i], "-h")==0) {
 			      output2histogram = 1;
 	      }
+	      else if (strcmp(argv[i], "-p")==0) {
+			      perturbation = 1;
+	      }
+	      else if (strcmp(argv[i], "-f")==0) {
+			      interior_check = 1;
+	      }
 	      else if (strcmp(argv[i], "-i")==0) {
 			      maxiter = atoi(argv[++i]);
 	      }
@@ -182,27 +231,41 @@ int main(int argc, char *argv[]) {
 	      }
 	      else if (strcmp(argv[i], "-c")==0) {
 			      x0 = atof(argv[++i]);
+			      center_real = dd_parse(argv[i]);
 			      y0 = atof(argv[++i]);
+			      center_imag = dd_parse(argv[i]);
 	      }
 	      else if (strcmp(argv[i], "-u")==0) {
 			      user_param = atof(argv[++i]);
 	      }
+	      else if (strcmp(argv[i], "-t")==0) {
+			      tile_cache = 1;
+	      }
+	      else if (strcmp(argv[i], "-T")==0) {
+			      tile_cache = 1;
+			      tiles_open(argv[++i]);
+	      }
 	      else if (strcmp(argv[i], "-s")==0) {
 			      size = atof(argv[++i]);
 	      }
 	      else if (strcmp(argv[i], "-o")==0) {
                               output2file = 1;
 			      sprintf(filename, "output_omp_%d.out", omp_get_max_threads());
-    			      if((fp=fopen(filename, "wb"))==NULL) {
+    			      if((fp=fopen(filename, "w+b"))==NULL) {
 				      fprintf(stderr, "Unable to open file\n");
 				      return EXIT_FAILURE;
 			      }
 	      }
 	      else {
-		      fprintf(stderr, "Usage: %s [-o -h -d -i maxiter -w windowsize -c x0 y0 -s size]\n", argv[0]);
+		      fprintf(stderr, "Usage: %s [-o -h -d -f -p -t -T dir -i maxiter -w windowsize -c x0 y0 -s size]\n", argv[0]);
 		      fprintf(stderr, "       -o to write computed image and histogram to disk (default no file generated)\n");
 		      fprintf(stderr, "       -h to produce histogram of values in computed image (default no histogream)\n");
 		      fprintf(stderr, "       -d to display computed image (default no display)\n");
+		      fprintf(stderr, "       -f to detect points inside the set and skip their iterations (default iterate all points)\n");
+		      fprintf(stderr, "       -p to compute the image by perturbation, for deep zooms (default direct iteration)\n");
+		      fprintf(stderr, "       -t to keep the computed tiles and reuse them when zooming and panning (moves the center and\n");
+		      fprintf(stderr, "          size to the closest point spacing that is a power of two)\n");
+		      fprintf(stderr, "       -T to use the tile cache as -t, also saving the tiles in directory dir for later runs\n");
 		      fprintf(stderr, "       -i to specify maximum number of iterations at each point (default 1000)\n");
 		      fprintf(stderr, "       -w to specify the size of the image to compute (default 800x800 elements)\n");
 		      fprintf(stderr, "       -c to specify the center x0+iy0 of the square to compute (default origin)\n");
@@ -210,25 +273,36 @@ int main(int argc, char *argv[]) {
         	      return EXIT_FAILURE;
 	      }
     }
+    if (perturbation && interior_check) {
+        fprintf(stderr, "-f can not be used with -p: the interior tests need the point in double precision\n");
+        return EXIT_FAILURE;
+    }
     real_min = x0 - size;
     real_max = x0 + size;
     imag_min = y0 - size;
     imag_max = y0 + size;
+    if (tile_cache && !perturbation) {
+        double scale;
+        tiles_snap(x0, y0, size, width, height, &scale, &real_min, &imag_min);
+        real_max = real_min + width * scale;
+        imag_max = imag_min + height * scale;
+    }
 
     // Produce text output
     fprintf(stdout, "\n");
     fprintf(stdout, "Computation of the Mandelbrot set with:\n");
     fprintf(stdout, "    center = (%g, %g) \n    size = %g\n    maximum iterations = %d\n",
             (real_max + real_min)/2, (imag_max + imag_min)/2,
-            (real_max - real_min)/2,
+            perturbation ? size : (real_max - real_min)/2,
             maxiter);
     fprintf(stdout, "\n");
 
-    output = malloc(height*sizeof(int *));
-    for (int row = 0; row < height; ++row)
-	    output[row] = malloc(width*sizeof(int));
+    output = image_alloc(height, width, &stride);
 
-    if (output2histogram) histogram = calloc(maxiter, sizeof(int));
+    if (output2histogram) {
+        histogram = calloc(maxiter, sizeof(int));
+        histogram_alloc(maxiter);
+    }
 
     if (output2display) {
         /* Initialize for graphical display */
@@ -240,9 +314,17 @@ int main(int argc, char *argv[]) {
        }
     }
 
-    // Compute factors to scale computational region to window
-    scale_real = (double) (real_max - real_min) / (double) width;
-    scale_imag = (double) (imag_max - imag_min) / (double) height;
+    // Compute factors to scale computational region to window. With -p the
+    // points are offsets from the center, so the spacing is taken from size:
+    // (x0+size) - (x0-size) rounds to a multiple of ulp(x0) in deep zooms
+    if (perturbation) {
+        scale_real = 2 * size / (double) width;
+        scale_imag = 2 * size / (double) height;
+    }
+    else {
+        scale_real = (double) (real_max - real_min) / (double) width;
+        scale_imag = (double) (imag_max - imag_min) / (double) height;
+    }
 
     if (output2display) {
         // Compute factor for color scaling
@@ -254,7 +336,8 @@ int main(int argc, char *argv[]) {
         START_COUNT_TIME;
     }
 
-    mandelbrot(height, width, real_min, imag_min, scale_real, scale_imag, maxiter, output);
+    mandelbrot(height, width, real_min, imag_min, scale_real, scale_imag, maxiter, output, stride);
+    if (output2histogram) histogram_merge(maxiter);
 
     // End timing
     if (!output2display) {
@@ -265,14 +348,15 @@ int main(int argc, char *argv[]) {
     fprintf(stdout, "Mandelbrot set: Computed\n");
     if (output2histogram) fprintf(stdout, "Histogram for Mandelbrot set: Computed\n");
     else fprintf(stdout, "Histogram for Mandelbrot set: Not computed\n");
+    if (tile_cache) fprintf(stdout, "Tile cache: %ld tiles reused, %ld read from disk, %ld computed (%ld from the coarser level)\n",
+                            tile_hits, tile_loaded, tile_misses, tile_seeded);
 
     // Make sure all output is written
     if ((output2display) && (setup_return == EXIT_SUCCESS)) XFlush (display);
 
     if ((output2file) && (fp != NULL)) {
         fprintf(stdout, "Writing output file to disk: %s\n", filename);
-        for (int row = 0; row < height; ++row)
-            if(fwrite(output[row], sizeof(int), width, fp) != width)
+        if (!image_write(fp, height, width, stride, output))
 	        fprintf(stderr, "Error when writing output to file\n");
         if (output2histogram)
             if(fwrite(histogram, sizeof(int), maxiter, fp) != maxiter)
@@ -0,0 +1,130 @@
+/*
+ * Framebuffer display for the Mandelbrot programs
+ *
+ * Threads computing the image do not call Xlib: display_point() stores the
+ * color of the point in a client-side XImage and marks its row as dirty.
+ * While mandelbrot() runs, a presenter thread wakes up DISPLAY_FPS times per
+ * second and sends each band of consecutive dirty rows to the window with a
+ * single XPutImage, so the image still shows up progressively as it is
+ * computed but no critical section is needed around each point.
+ *
+ * If compiled with -DUSE_MITSHM (link with -lXext) and the X server supports
+ * the MIT-SHM extension, the XImage lives in shared memory and is sent with
+ * XShmPutImage, avoiding the copy of the pixels through the X connection.
+ *
+ * Has to be included after the declaration of display, win and gc.
+ * Link with -lpthread.
+ */
+
+#include <pthread.h>
+#include <time.h>
+#ifdef USE_MITSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+
+#define DISPLAY_FPS 30          /* frames per second sent by the presenter thread */
+
+XImage *framebuffer = NULL;     // colors of the computed points
+unsigned char *dirty_rows;      // rows with points not sent to the window yet
+int presenter_done;
+pthread_t presenter;
+#ifdef USE_MITSHM
+XShmSegmentInfo shminfo;
+int use_shm = 0;
+#endif
+
+// Store the color of point (row, col), it will be shown with the next frame
+static inline void display_point(int row, int col, long color) {
+    XPutPixel(framebuffer, col, row, color);
+    // seq_cst orders the pixel before the flag for the presenter
+    #pragma omp atomic write seq_cst
+    dirty_rows[row] = 1;
+}
+
+// Send all bands of dirty rows to the window
+static void display_push(void) {
+    int height = framebuffer->height;
+    int row = 0;
+    while (row < height) {
+        unsigned char dirty;
+        int first = row;
+        do {
+            #pragma omp atomic capture seq_cst
+            { dirty = dirty_rows[row]; dirty_rows[row] = 0; }
+            if (dirty) ++row;
+        } while (dirty && row < height);
+
+        if (row > first) {
+#ifdef USE_MITSHM
+            if (use_shm)
+                XShmPutImage(display, win, gc, framebuffer, 0, first, 0, first,
+                             framebuffer->width, row - first, False);
+            else
+#endif
+            XPutImage(display, win, gc, framebuffer, 0, first, 0, first,
+                      framebuffer->width, row - first);
+        }
+        else ++row;
+    }
+    XFlush(display);
+}
+
+static void *presenter_loop(void *arg) {
+    (void) arg;
+    struct timespec period = { 0, 1000000000L / DISPLAY_FPS };
+    int done;
+    do {
+        nanosleep(&period, NULL);
+        #pragma omp atomic read seq_cst
+        done = presenter_done;
+        // done is set after all points are stored, and seq_cst makes them
+        // visible here once it is seen, so this last push sends the rest
+        display_push();
+    } while (!done);
+    return NULL;
+}
+
+static void framebuffer_alloc(int height, int width) {
+    int screen = DefaultScreen(display);
+    Visual *visual = DefaultVisual(display, screen);
+    int depth = DefaultDepth(display, screen);
+
+#ifdef USE_MITSHM
+    if (XShmQueryExtension(display)) {
+        framebuffer = XShmCreateImage(display, visual, depth, ZPixmap, NULL, &shminfo, width, height);
+        shminfo.shmid = shmget(IPC_PRIVATE, framebuffer->bytes_per_line * height, IPC_CREAT | 0600);
+        shminfo.shmaddr = framebuffer->data = shmat(shminfo.shmid, NULL, 0);
+        shminfo.readOnly = False;
+        use_shm = XShmAttach(display, &shminfo);
+        XSync(display, False);
+        // segment is released as soon as both sides detach
+        shmctl(shminfo.shmid, IPC_RMID, NULL);
+        if (!use_shm) {
+            shmdt(shminfo.shmaddr);
+            XDestroyImage(framebuffer);
+        }
+    }
+    if (!use_shm)
+#endif
+    {
+        framebuffer = XCreateImage(display, visual, depth, ZPixmap, 0, NULL, width, height, 32, 0);
+        framebuffer->data = calloc(framebuffer->bytes_per_line, height);
+    }
+    dirty_rows = calloc(height, sizeof(unsigned char));
+}
+
+// Start the presenter thread, called before computing an image
+void display_start(int height, int width) {
+    if (framebuffer == NULL) framebuffer_alloc(height, width);
+    presenter_done = 0;
+    pthread_create(&presenter, NULL, presenter_loop, NULL);
+}
+
+// Wait for the presenter thread to send the last rows, called once the image is computed
+void display_stop(void) {
+    #pragma omp atomic write seq_cst
+    presenter_done = 1;
+    pthread_join(presenter, NULL);
+}
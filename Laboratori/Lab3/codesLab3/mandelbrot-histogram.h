@@ -0,0 +1,46 @@
+/*
+ * Privatized histogram for the Mandelbrot programs
+ *
+ * Instead of incrementing the shared histogram atomically for every point,
+ * each thread counts into its own private histogram. Private histograms are
+ * padded to a whole number of cache lines so that no two threads write to
+ * the same line, and they are added up into histogram[] in parallel, each
+ * thread reducing a contiguous chunk of bins, once the image is computed.
+ *
+ * Has to be included after the declaration of the global histogram.
+ */
+
+#define HISTOGRAM_LINE 16       /* ints per cache line */
+
+int *histogram_private;         // private histograms of all threads, one after the other
+int histogram_stride;           // distance (in ints) between the private histograms of two threads
+int histogram_threads;
+
+// Allocate the private histograms, each one zeroed by the thread that will use it
+void histogram_alloc(int maxiter) {
+    histogram_threads = omp_get_max_threads();
+    histogram_stride = (maxiter + HISTOGRAM_LINE - 1) / HISTOGRAM_LINE * HISTOGRAM_LINE;
+    histogram_private = aligned_alloc(64, (size_t) histogram_threads * histogram_stride * sizeof(int));
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int t = 0; t < histogram_threads; ++t)
+        memset(&histogram_private[(size_t) t * histogram_stride], 0, histogram_stride * sizeof(int));
+}
+
+// Count a point with k iterations in the private histogram of the calling thread
+static inline void histogram_add(int k) {
+    histogram_private[(size_t) omp_get_thread_num() * histogram_stride + k-1]++;
+}
+
+// Add the private histograms to histogram[] and clear them for the next image
+void histogram_merge(int maxiter) {
+    #pragma omp parallel for schedule(static)
+    for (int bin = 0; bin < maxiter; ++bin) {
+        int sum = 0;
+        for (int t = 0; t < histogram_threads; ++t) {
+            sum += histogram_private[(size_t) t * histogram_stride + bin];
+            histogram_private[(size_t) t * histogram_stride + bin] = 0;
+        }
+        histogram[bin] += sum;
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Image buffer for the Mandelbrot programs
+ *
+ * The computed image is a single 64-byte aligned block of ints, where
+ * point (row, col) is stored at image[row*stride + col] and stride is the
+ * width rounded up to a whole number of cache lines, so every row starts
+ * aligned. The block is zeroed in parallel by rows, so that the pages of
+ * each row are first touched (and placed in the NUMA node of) a thread
+ * of the team that computes the image.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define IMAGE_LINE 16           /* ints per cache line */
+
+// Allocate an image of height x width points, returns its row stride in stride
+int *image_alloc(int height, int width, int *stride) {
+    int s = (width + IMAGE_LINE - 1) / IMAGE_LINE * IMAGE_LINE;
+    int *image = aligned_alloc(64, (size_t) height * s * sizeof(int));
+
+    #pragma omp parallel for schedule(static)
+    for (int row = 0; row < height; ++row)
+        memset(&image[(size_t) row * s], 0, s * sizeof(int));
+
+    *stride = s;
+    return image;
+}
+
+// Write the image to fp as height*width consecutive ints, same as writing it
+// row by row. Returns 0 in case of error.
+int image_write(FILE *fp, int height, int width, int stride, int *image) {
+    size_t bytes = (size_t) height * width * sizeof(int);
+
+    // No padding at the end of the rows: the image is written at once
+    if (stride == width)
+        return fwrite(image, sizeof(int), (size_t) height * width, fp) == (size_t) height * width;
+
+    // Otherwise the part of the file holding the image is mapped in memory
+    // and the rows are copied into it in parallel (fp has to be open for
+    // reading and writing)
+    int fd = fileno(fp);
+    fflush(fp);
+    off_t offset = ftello(fp);
+    off_t base = offset & ~((off_t) sysconf(_SC_PAGESIZE) - 1);
+    if (ftruncate(fd, offset + bytes) != 0) return 0;
+
+    char *map = mmap(NULL, offset - base + bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, base);
+    if (map == MAP_FAILED) return 0;
+    char *file = map + (offset - base);
+
+    #pragma omp parallel for schedule(static)
+    for (int row = 0; row < height; ++row)
+        memcpy(&file[(size_t) row * width * sizeof(int)], &image[(size_t) row * stride], width * sizeof(int));
+
+    munmap(map, offset - base + bytes);
+    return fseeko(fp, offset + bytes, SEEK_SET) == 0;
+}
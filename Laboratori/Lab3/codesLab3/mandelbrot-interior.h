@@ -0,0 +1,51 @@
+/*
+ * Interior detection for the Mandelbrot programs
+ *
+ * Points inside the set never escape, so they always run the maxiter
+ * iterations. Two tests return maxiter early for them and give exactly the
+ * same result as the exhaustive loop:
+ *   - the main cardioid and the period-2 bulb are tested analytically,
+ *   - otherwise the orbit is checked for periodicity with Brent's method:
+ *     z is saved at iterations 1, 2, 4, 8, ... and if a later iterate is
+ *     bitwise equal to the saved one the orbit repeats forever (the
+ *     iteration is deterministic), so it can not escape.
+ *
+ * The analytic tests may only misclassify points within a few ulps of the
+ * boundary, whose escape time is far beyond any practical maxiter.
+ */
+
+// Point c is inside the main cardioid or the period-2 bulb
+static inline int mandel_in_cardioid(double x, double y) {
+    double q = (x - 0.25)*(x - 0.25) + y*y;
+    return (q*(q + (x - 0.25)) < 0.25*y*y) || ((x + 1)*(x + 1) + y*y < 0.0625);
+}
+
+// Number of iterations of point c, same as the exhaustive loop
+static inline int mandel_interior(complex c, int maxiter) {
+    if (mandel_in_cardioid(c.real, c.imag)) return maxiter;
+
+    complex z, saved;
+    int k = 0;
+    long next = 1;
+    double lengthsq, temp;
+
+    z.real = z.imag = 0;
+    saved = z;
+    do  {
+        temp = z.real*z.real - z.imag*z.imag + c.real;
+        z.imag = 2*z.real*z.imag + c.imag;
+        z.real = temp;
+        lengthsq = z.real*z.real + z.imag*z.imag;
+        ++k;
+        if (lengthsq >= (N*N)) break;
+
+        // Periodic orbit, it will never escape
+        if (z.real == saved.real && z.imag == saved.imag) return maxiter;
+        if (k == next) {
+            saved = z;
+            next *= 2;
+        }
+    } while (k < maxiter);
+
+    return k;
+}
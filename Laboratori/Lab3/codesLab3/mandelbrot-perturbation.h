@@ -0,0 +1,197 @@
+/*
+ * Perturbation engine for deep zooms in the Mandelbrot programs
+ *
+ * A single reference orbit Z_n is computed at the center of the image in
+ * double-double arithmetic (about 106 bits of mantissa). Every point
+ * c = center + dc is then iterated in plain double precision as a delta
+ * from the reference orbit
+ *     d_{n+1} = 2 Z_n d_n + d_n^2 + dc,    z_n = Z_n + d_n
+ * which only involves small numbers, so it stays accurate far below the
+ * 1e-13 scale where double coordinates stop telling points apart. When
+ * |z_n| drops below |d_n|, or the reference orbit ends because it escaped,
+ * the delta is rebased onto the start of the reference orbit (d = z, n = 0),
+ * which avoids the glitches of the plain perturbation formula.
+ *
+ * The first iterations are skipped for all points with the series
+ * approximation d_n ~ A_n dc + B_n dc^2 + C_n dc^3, whose coefficients are
+ * computed along with the reference orbit for as long as the cubic term is
+ * negligible for the farthest point of the image.
+ *
+ * Do not compile with -ffast-math, double-double arithmetic relies on
+ * IEEE rounding.
+ */
+
+#define SA_TOLERANCE 1e-12      /* relative size of the cubic term that ends the series approximation */
+
+// Double-double numbers: value is hi + lo, with |lo| <= ulp(hi)/2
+typedef struct {
+    double hi, lo;
+} dd;
+
+static inline dd quick_two_sum(double a, double b) {
+    double s = a + b;
+    return (dd) { s, b - (s - a) };
+}
+
+static inline dd two_sum(double a, double b) {
+    double s = a + b, v = s - a;
+    return (dd) { s, (a - (s - v)) + (b - v) };
+}
+
+static inline dd two_prod(double a, double b) {
+    double p = a * b;
+    return (dd) { p, fma(a, b, -p) };
+}
+
+static inline dd dd_add(dd a, dd b) {
+    dd s = two_sum(a.hi, b.hi);
+    return quick_two_sum(s.hi, s.lo + a.lo + b.lo);
+}
+
+static inline dd dd_sub(dd a, dd b) {
+    return dd_add(a, (dd) { -b.hi, -b.lo });
+}
+
+static inline dd dd_mul(dd a, dd b) {
+    dd p = two_prod(a.hi, b.hi);
+    return quick_two_sum(p.hi, p.lo + (a.hi * b.lo + a.lo * b.hi));
+}
+
+static inline dd dd_mul_d(dd a, double b) {
+    dd p = two_prod(a.hi, b);
+    return quick_two_sum(p.hi, p.lo + a.lo * b);
+}
+
+static inline dd dd_div_d(dd a, double b) {
+    double q1 = a.hi / b;
+    dd r = dd_sub(a, two_prod(q1, b));
+    double q2 = r.hi / b;
+    r = dd_sub(r, two_prod(q2, b));
+    return dd_add(quick_two_sum(q1, q2), (dd) { r.hi / b, 0 });
+}
+
+// Decimal number in s (as accepted by atof, e.g. -0.74364388703715870475e-1)
+// to double-double, keeping the digits that do not fit in a double
+dd dd_parse(const char *s) {
+    dd x = { 0, 0 };
+    int negative = 0, fraction = 0, exponent = 0;
+
+    if (*s == '-' || *s == '+') negative = (*s++ == '-');
+    for (; *s != '\0'; ++s) {
+        if (*s >= '0' && *s <= '9') {
+            x = dd_add(dd_mul_d(x, 10), (dd) { *s - '0', 0 });
+            if (fraction) --exponent;
+        }
+        else if (*s == '.') fraction = 1;
+        else if (*s == 'e' || *s == 'E') {
+            exponent += atoi(s+1);
+            break;
+        }
+        else break;
+    }
+    for (; exponent > 0; --exponent) x = dd_mul_d(x, 10);
+    for (; exponent < 0; ++exponent) x = dd_div_d(x, 10);
+    return negative ? (dd) { -x.hi, -x.lo } : x;
+}
+
+// Center of the image, set from the command line
+dd center_real = { 0, 0 }, center_imag = { 0, 0 };
+
+complex *reference = NULL;      // reference orbit Z_0 .. Z_reference_length
+int reference_length;
+int sa_skip;                    // iterations skipped with the series approximation
+complex sa_a, sa_b, sa_c;       // coefficients of the series at iteration sa_skip
+
+static inline double cabs_(complex z) {
+    return sqrt(z.real*z.real + z.imag*z.imag);
+}
+
+// Compute the reference orbit at the center and the series approximation,
+// valid for all points at distance up to radius from the center
+void perturbation_reference(int maxiter, double radius) {
+    dd zr = { 0, 0 }, zi = { 0, 0 };
+    complex a = { 0, 0 }, b = { 0, 0 }, c = { 0, 0 };
+    int valid = 1;
+
+    reference = realloc(reference, (maxiter + 1) * sizeof(complex));
+    reference[0].real = reference[0].imag = 0;
+    sa_skip = 0;
+    sa_a = sa_b = sa_c = a;
+
+    int n = 0;
+    while (n < maxiter) {
+        complex z = reference[n];
+
+        if (valid) {
+            // A' = 2ZA + 1, B' = 2ZB + A^2, C' = 2ZC + 2AB
+            complex a1, b1, c1;
+            a1.real = 2*(z.real*a.real - z.imag*a.imag) + 1;
+            a1.imag = 2*(z.real*a.imag + z.imag*a.real);
+            b1.real = 2*(z.real*b.real - z.imag*b.imag) + a.real*a.real - a.imag*a.imag;
+            b1.imag = 2*(z.real*b.imag + z.imag*b.real) + 2*a.real*a.imag;
+            c1.real = 2*(z.real*c.real - z.imag*c.imag) + 2*(a.real*b.real - a.imag*b.imag);
+            c1.imag = 2*(z.real*c.imag + z.imag*c.real) + 2*(a.real*b.imag + a.imag*b.real);
+            a = a1; b = b1; c = c1;
+        }
+
+        // Z_{n+1} = Z_n^2 + center
+        dd zri = dd_mul(zr, zi);
+        zr = dd_add(dd_sub(dd_mul(zr, zr), dd_mul(zi, zi)), center_real);
+        zi = dd_add(dd_mul_d(zri, 2), center_imag);
+        ++n;
+        reference[n].real = zr.hi;
+        reference[n].imag = zi.hi;
+
+        if (valid) {
+            double ta = cabs_(a) * radius;
+            double tb = cabs_(b) * radius * radius;
+            double tc = cabs_(c) * radius * radius * radius;
+            double delta = ta + tb + tc;
+            double zn = cabs_(reference[n]);
+            // cubic term negligible, no point escapes and no delta needs
+            // rebasing during the skipped iterations
+            valid = (tc <= SA_TOLERANCE * ta) && (zn + delta < N) && (delta < 0.5 * zn) && (n < maxiter);
+            if (valid) {
+                sa_skip = n;
+                sa_a = a; sa_b = b; sa_c = c;
+            }
+        }
+
+        if (zr.hi*zr.hi + zi.hi*zi.hi >= (N*N)) break;
+    }
+    reference_length = n;
+}
+
+// Number of iterations of point center + (dcr + i dci)
+static inline int perturbation_point(double dcr, double dci, int maxiter) {
+    // Start from the series approximation
+    double dc2r = dcr*dcr - dci*dci, dc2i = 2*dcr*dci;
+    double dc3r = dc2r*dcr - dc2i*dci, dc3i = dc2r*dci + dc2i*dcr;
+    double dr = (sa_a.real*dcr - sa_a.imag*dci) + (sa_b.real*dc2r - sa_b.imag*dc2i)
+              + (sa_c.real*dc3r - sa_c.imag*dc3i);
+    double di = (sa_a.real*dci + sa_a.imag*dcr) + (sa_b.real*dc2i + sa_b.imag*dc2r)
+              + (sa_c.real*dc3i + sa_c.imag*dc3r);
+    int k = sa_skip, m = sa_skip;
+    double lengthsq;
+
+    do  {
+        double zr = reference[m].real, zi = reference[m].imag;
+        double temp = 2*(zr*dr - zi*di) + (dr*dr - di*di) + dcr;
+        di = 2*(zr*di + zi*dr) + 2*dr*di + dci;
+        dr = temp;
+        ++m;
+        ++k;
+
+        zr = reference[m].real + dr;
+        zi = reference[m].imag + di;
+        lengthsq = zr*zr + zi*zi;
+        if (lengthsq < dr*dr + di*di || m == reference_length) {
+            // Rebase onto the start of the reference orbit
+            dr = zr;
+            di = zi;
+            m = 0;
+        }
+    } while (lengthsq < (N*N) && k < maxiter);
+
+    return k;
+}
@@ -0,0 +1,97 @@
+/*
+ * SIMD kernel for the Mandelbrot programs
+ *
+ * Computes the number of iterations of MANDEL_LANES adjacent points of
+ * a row at once, using GCC vector extensions: 8 lanes with AVX-512,
+ * 4 lanes with AVX/AVX2 and 2 lanes (SSE2) otherwise. Lanes that have
+ * already escaped are masked off and the loop finishes when all lanes
+ * are done, so every lane executes exactly the same sequence of floating
+ * point operations as the scalar do/while loop in mandelbrot().
+ *
+ * Note: when compiling with FMA support (-mfma, -march=native, ...) also
+ * use -ffp-contract=off, otherwise the compiler may fuse multiplies and
+ * adds differently in the scalar and vector code and the results are no
+ * longer bit for bit identical.
+ *
+ * Uses mandel_in_cardioid() from mandelbrot-interior.h, which has to be
+ * included first.
+ */
+
+#if defined(__AVX512F__)
+#define MANDEL_LANES 8
+#elif defined(__AVX__)
+#define MANDEL_LANES 4
+#else
+#define MANDEL_LANES 2
+#endif
+
+typedef double    vdouble __attribute__ ((vector_size (MANDEL_LANES*sizeof(double))));
+typedef long long vlong   __attribute__ ((vector_size (MANDEL_LANES*sizeof(long long))));
+
+// Select lanes of a where mask is set, lanes of b otherwise
+#define VSELECT(mask, a, b) ((vdouble) (((vlong) (a) & (mask)) | ((vlong) (b) & ~(mask))))
+
+static inline int vany(vlong mask) {
+    long long any = 0;
+    for (int l = 0; l < MANDEL_LANES; ++l) any |= mask[l];
+    return any != 0;
+}
+
+// Iterations for the points in columns col .. col+MANDEL_LANES-1 of the row
+// with imaginary part c_imag. Columns past the end of the row are computed
+// as well and just have to be ignored by the caller. If interior is set,
+// points inside the main cardioid or the period-2 bulb are not iterated and
+// orbits are checked for periodicity, as in mandel_interior().
+static inline void mandel_simd(int col, double c_imag, double real_min, double scale_real,
+                               int maxiter, int interior, int k[MANDEL_LANES]) {
+    vdouble zr, zi, cr, ci, temp, lengthsq;
+    vlong kv, limit, active;
+
+    for (int l = 0; l < MANDEL_LANES; ++l) {
+        /* Scale display coordinates to actual region  */
+        cr[l] = real_min + ((double) (col + l) * scale_real);
+        ci[l] = c_imag;
+        zr[l] = zi[l] = 0;
+        kv[l] = (interior && mandel_in_cardioid(cr[l], ci[l])) ? maxiter : 0;
+        limit[l] = maxiter;
+    }
+    active = (kv < limit);
+
+    // Calculate z0, z1, .... until divergence or maximum iterations in all lanes
+    if (!interior) {
+        do  {
+            temp = zr*zr - zi*zi + cr;
+            zi = VSELECT(active, 2*zr*zi + ci, zi);
+            zr = VSELECT(active, temp, zr);
+            lengthsq = zr*zr + zi*zi;
+            kv -= active;       // active lanes are all ones, i.e. -1
+            active &= (lengthsq < (N*N)) & (kv < limit);
+        } while (vany(active));
+    }
+    else {
+        // All active lanes are at the same iteration, so z is saved for all
+        // of them at iterations 1, 2, 4, 8, ... as in mandel_interior()
+        vdouble saved_r = zr, saved_i = zi;
+        long iter = 0, next = 1;
+        do  {
+            temp = zr*zr - zi*zi + cr;
+            zi = VSELECT(active, 2*zr*zi + ci, zi);
+            zr = VSELECT(active, temp, zr);
+            lengthsq = zr*zr + zi*zi;
+            kv -= active;
+            active &= (lengthsq < (N*N)) & (kv < limit);
+
+            // Periodic orbits will never escape
+            vlong periodic = active & (zr == saved_r) & (zi == saved_i);
+            kv = (kv & ~periodic) | (limit & periodic);
+            active &= ~periodic;
+            if (++iter == next) {
+                saved_r = zr;
+                saved_i = zi;
+                next *= 2;
+            }
+        } while (vany(active));
+    }
+
+    for (int l = 0; l < MANDEL_LANES; ++l) k[l] = kv[l];
+}
@@ -0,0 +1,247 @@
+/*
+ * Tile cache for interactive zoom and pan in the Mandelbrot programs
+ *
+ * Points are taken on a lattice: at level L the distance between points is
+ * s = 2^-L and point (x, y) of the lattice is c = x*s + i*y*s. The lattice
+ * is split in tiles of TILE x TILE points, and the escape counts of every
+ * computed tile are kept in a cache indexed by (level, maxiter, interior,
+ * tile x, tile y), interior being the flag of mandel_simd() that skips the
+ * points of the main cardioid and bulb. An image whose bottom-left point and point spacing lie on the
+ * lattice (see tiles_snap() and tiles_on_lattice()) is assembled from the
+ * tiles: after a pan by any number of pixels only the tiles newly exposed
+ * are computed, and after a zoom by 2 the points of a tile that are also on
+ * the previous level (one in four) are copied from the cached coarser tile.
+ *
+ * Products and sums of multiples of a power of two are exact, so the
+ * coordinates of a point are the same whatever tile, level or image it is
+ * computed for, and so is its escape count: images from the cache are bit
+ * for bit identical to the ones computed directly by mandelbrot().
+ *
+ * With tiles_open(dir), computed tiles are also saved as files in dir and
+ * reused by later runs. The cache is not thread safe: tiles_render() is
+ * called by one thread, and computes the missing tiles in parallel.
+ *
+ * Uses mandel_simd() from mandelbrot-simd.h, which has to be included first.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TILE        64          /* points per side of a tile */
+#define TILE_SETS   512         /* sets of the cache */
+#define TILE_WAYS   8           /* tiles per set, the cache holds TILE_SETS*TILE_WAYS tiles (16 KB each) */
+
+typedef struct {
+    int level, maxiter, interior;
+    long tx, ty;                // tile coordinates: first point is (tx*TILE, ty*TILE)
+    long used;                  // last render that used the tile, 0 if the entry is empty
+    int *k;                     // escape counts, k[yy*TILE + xx] for point (tx*TILE+xx, ty*TILE+yy)
+} tile_entry;
+
+tile_entry tile_sets[TILE_SETS][TILE_WAYS];
+long tile_render = 0;           // number of the current render
+const char *tile_dir = NULL;    // directory of the saved tiles, NULL if not saved
+long tile_hits, tile_misses, tile_loaded, tile_seeded;
+
+// Use the cache, saving the tiles in dir (if not NULL)
+void tiles_open(const char *dir) {
+    tile_dir = dir;
+}
+
+// Closest lattice image to the square of center x0+iy0 and half side size
+// shown in width x height points: sets the point spacing in scale and the
+// bottom left corner in real_min, imag_min
+void tiles_snap(double x0, double y0, double size, int width, int height,
+                double *scale, double *real_min, double *imag_min) {
+    int level = (int) lround(-log2(2*size / width));
+    double s = ldexp(1.0, -level);
+    *scale = s;
+    *real_min = floor((x0 - 0.5*width*s) / s) * s;
+    *imag_min = floor((y0 - 0.5*height*s) / s) * s;
+}
+
+// The image with bottom left corner real_min + i*imag_min and spacing scale
+// lies on the lattice of some level, returned in level
+int tiles_on_lattice(double real_min, double imag_min, double scale_real, double scale_imag, int *level) {
+    int e;
+    if (scale_real != scale_imag || frexp(scale_real, &e) != 0.5) return 0;
+    *level = 1 - e;
+    return floor(real_min / scale_real) * scale_real == real_min && floor(imag_min / scale_real) * scale_real == imag_min;
+}
+
+static inline unsigned tile_hash(int level, int maxiter, int interior, long tx, long ty) {
+    unsigned long h = (unsigned long) tx * 0x9E3779B97F4A7C15UL ^ (unsigned long) ty * 0xC2B2AE3D27D4EB4FUL
+                      ^ (unsigned long) level * 0x165667B19E3779F9UL ^ (unsigned long) maxiter ^ (unsigned long) interior << 40;
+    return (unsigned) ((h ^ (h >> 29)) % TILE_SETS);
+}
+
+// Entry of tile (tx, ty), NULL if it is not in the cache
+static tile_entry *tile_find(int level, int maxiter, int interior, long tx, long ty) {
+    tile_entry *set = tile_sets[tile_hash(level, maxiter, interior, tx, ty)];
+    for (int w = 0; w < TILE_WAYS; ++w)
+        if (set[w].used && set[w].level == level && set[w].maxiter == maxiter && set[w].interior == interior
+            && set[w].tx == tx && set[w].ty == ty)
+            return &set[w];
+    return NULL;
+}
+
+// Entry for a new tile (tx, ty), replacing the least recently used tile of
+// its set. Returns NULL if all of them are used by the current render.
+static tile_entry *tile_insert(int level, int maxiter, int interior, long tx, long ty) {
+    tile_entry *set = tile_sets[tile_hash(level, maxiter, interior, tx, ty)], *e = &set[0];
+    for (int w = 1; w < TILE_WAYS; ++w)
+        if (set[w].used < e->used) e = &set[w];
+    if (e->used == tile_render) return NULL;
+    if (e->k == NULL) e->k = malloc(TILE*TILE*sizeof(int));
+    e->level = level;
+    e->maxiter = maxiter;
+    e->interior = interior;
+    e->tx = tx;
+    e->ty = ty;
+    e->used = tile_render;
+    return e;
+}
+
+static void tile_name(char *name, size_t n, int level, int maxiter, int interior, long tx, long ty) {
+    snprintf(name, n, "%s/tile_%d_%d_%d_%ld_%ld", tile_dir, level, maxiter, interior, tx, ty);
+}
+
+// Header of the saved tiles: files written with another TILE or int size
+// are not read
+static const int tile_header[3] = { 0x54494c45, TILE, sizeof(int) };
+
+// Escape counts of tile (tx, ty) into k, read from its file if it was saved.
+// Otherwise points on the previous level are copied from coarse, if it is
+// not NULL. Returns 1 if the tile was read, 0 if it was computed.
+static int tile_compute(int level, int maxiter, long tx, long ty, int interior,
+                         const int *coarse, int *k) {
+    double s = ldexp(1.0, -level);
+    double real_min = (double) (tx*TILE) * s;
+    int ox = (tx & 1) * TILE/2, oy = (ty & 1) * TILE/2;     // origin of the tile in coarse
+    int kv[MANDEL_LANES];
+
+    if (tile_dir != NULL) {
+        char name[4096];
+        tile_name(name, sizeof(name), level, maxiter, interior, tx, ty);
+        FILE *f = fopen(name, "rb");
+        if (f != NULL) {
+            int header[3];
+            int ok = fread(header, sizeof(header), 1, f) == 1 && memcmp(header, tile_header, sizeof(header)) == 0
+                     && fread(k, sizeof(int), TILE*TILE, f) == TILE*TILE;
+            fclose(f);
+            if (ok) return 1;
+        }
+    }
+
+    for (int yy = 0; yy < TILE; ++yy) {
+        double c_imag = (double) (ty*TILE + yy) * s;
+        int *row = &k[yy*TILE];
+        if (coarse != NULL && yy % 2 == 0) {
+            // Even points are on the coarser lattice, odd points have spacing 2s starting at real_min + s
+            const int *crow = &coarse[(oy + yy/2)*TILE + ox];
+            for (int xx = 0; xx < TILE/2; ++xx) row[2*xx] = crow[xx];
+            for (int col = 0; col < TILE/2; col += MANDEL_LANES) {
+                mandel_simd(col, c_imag, real_min + s, 2*s, maxiter, interior, kv);
+                for (int l = 0; l < MANDEL_LANES && col + l < TILE/2; ++l) row[2*(col+l) + 1] = kv[l];
+            }
+        }
+        else {
+            for (int col = 0; col < TILE; col += MANDEL_LANES) {
+                mandel_simd(col, c_imag, real_min, s, maxiter, interior, kv);
+                for (int l = 0; l < MANDEL_LANES && col + l < TILE; ++l) row[col + l] = kv[l];
+            }
+        }
+    }
+
+    if (tile_dir != NULL) {
+        char name[4096];
+        tile_name(name, sizeof(name), level, maxiter, interior, tx, ty);
+        FILE *f = fopen(name, "wb");
+        if (f != NULL) {
+            fwrite(tile_header, sizeof(tile_header), 1, f);
+            fwrite(k, sizeof(int), TILE*TILE, f);
+            fclose(f);
+        }
+    }
+    return 0;
+}
+
+static inline long floor_div(long a, long b) {
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+// Escape counts of the height x width image of the lattice of level with
+// bottom left point (px, py) into output (rows of stride ints, row 0 at the
+// top, as in mandelbrot()). Returns the number of tiles computed, not counting
+// the ones read from the saved files.
+int tiles_render(int level, long px, long py, int width, int height, int maxiter, int interior,
+                 int *output, int stride) {
+    long tx0 = floor_div(px, TILE), tx1 = floor_div(px + width - 1, TILE);
+    long ty0 = floor_div(py, TILE), ty1 = floor_div(py + height - 1, TILE);
+    long ntiles = (tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+    tile_entry **tiles = malloc(ntiles * sizeof(tile_entry *));
+    int **counts = malloc(ntiles * sizeof(int *));
+    const int **seeds = malloc(ntiles * sizeof(int *));
+    long *missing = malloc(ntiles * sizeof(long));
+    long nmissing = 0;
+
+    // Find the tiles in the cache, and entries (or temporary buffers if the
+    // cache is full) for the missing ones
+    tile_render++;
+    for (long t = 0; t < ntiles; ++t) {
+        long tx = tx0 + t % (tx1 - tx0 + 1), ty = ty0 + t / (tx1 - tx0 + 1);
+        tile_entry *e = tile_find(level, maxiter, interior, tx, ty);
+        if (e != NULL) {
+            e->used = tile_render;
+            tiles[t] = e;
+            counts[t] = e->k;
+            tile_hits++;
+            continue;
+        }
+        e = tile_insert(level, maxiter, interior, tx, ty);
+        tiles[t] = e;
+        counts[t] = (e != NULL) ? e->k : malloc(TILE*TILE*sizeof(int));
+        tile_entry *c = tile_find(level-1, maxiter, interior, tx >> 1, ty >> 1);
+        if (c != NULL) c->used = tile_render;   // not replaced while it is read
+        seeds[t] = (c != NULL) ? c->k : NULL;
+        missing[nmissing++] = t;
+    }
+
+    // Tiles may cost very different times, near the set or far from it
+    long loaded = 0, seeded = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:loaded, seeded)
+    for (long m = 0; m < nmissing; ++m) {
+        long t = missing[m];
+        long tx = tx0 + t % (tx1 - tx0 + 1), ty = ty0 + t / (tx1 - tx0 + 1);
+        if (tile_compute(level, maxiter, tx, ty, interior, seeds[t], counts[t])) loaded++;
+        else if (seeds[t] != NULL) seeded++;
+    }
+    tile_loaded += loaded;
+    tile_misses += nmissing - loaded;
+    tile_seeded += seeded;
+
+    // Image row r is lattice row py + height-1-r
+    #pragma omp parallel for schedule(static)
+    for (int row = 0; row < height; ++row) {
+        long y = py + height - 1 - row;
+        long ty = floor_div(y, TILE);
+        int yy = y - ty*TILE;
+        for (long tx = tx0; tx <= tx1; ++tx) {
+            long t = (ty - ty0) * (tx1 - tx0 + 1) + (tx - tx0);
+            long x_start = (tx*TILE > px) ? tx*TILE : px;
+            long x_end = ((tx+1)*TILE < px + width) ? (tx+1)*TILE : px + width;
+            memcpy(&output[row*stride + (x_start - px)], &counts[t][yy*TILE + (x_start - tx*TILE)],
+                   (x_end - x_start) * sizeof(int));
+        }
+    }
+
+    for (long t = 0; t < ntiles; ++t)
+        if (tiles[t] == NULL) free(counts[t]);
+    free(tiles);
+    free(counts);
+    free(seeds);
+    free(missing);
+    return nmissing - loaded;
+}
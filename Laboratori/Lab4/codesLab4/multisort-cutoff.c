@@ -5,25 +5,26 @@
 #include <unistd.h>
 #include "omp.h"
 
-#include <sys/time.h>
-double getusec_() {
-    struct timeval time;
-    gettimeofday(&time, NULL);
-    return ((double)time.tv_sec * (double)1e6 + (double)time.tv_usec);
-}
+#include "../../common/par-timing.h"
+#include "../../common/par-instrument.h"
 
 #define START_COUNT_TIME stamp = getusec_();
 #define STOP_COUNT_TIME(_m) stamp = getusec_() - stamp;\
                                     stamp = stamp/1e6;\
-                                    printf ("%s: %0.6f\n",(_m), stamp);
+                                    printf ("%s: %0.6f\n",(_m), stamp);\
+                                    par_timing_record((_m), stamp);
 
 // N and MIN must be powers of 2
 long N;
 long MIN_SORT_SIZE;
 long MIN_MERGE_SIZE;
 int CUTOFF;
+long BATCH;                 // base cases per leaf task
+int radix = 0;
+int tune = 0;
+int lowmem = 0;
 
-#define T int
+#include "multisort-type.h"
 
 void basicsort(long n, T data[n]);
 
@@ -34,13 +35,16 @@ void merge(long n, T left[n], T right[n], T result[n*2], long start, long length
                 // Base case
                 basicmerge(n, left, right, result, start, length);
         } else {
-                // Recursive decomposition
-                if (!omp_in_final()) {
+                // Recursive decomposition, merges of less than BATCH base
+                // cases are done by the task that reaches them
+                if (!omp_in_final() && length >= MIN_MERGE_SIZE*2L*BATCH) {
+                  PAR_TASK_CREATED;
                   #pragma omp task final (d >= CUTOFF)
-                  merge(n, left, right, result, start, length/2, d+1);
+                  PAR_TASK(merge(n, left, right, result, start, length/2, d+1));
+                  PAR_TASK_CREATED;
                   #pragma omp task final (d >= CUTOFF)
-                  merge(n, left, right, result, start + length/2, length/2, d+1);
-                  #pragma omp taskwait	
+                  PAR_TASK(merge(n, left, right, result, start + length/2, length/2, d+1));
+                  PAR_TASKWAIT;
                 }
                 else {
                   merge(n, left, right, result, start, length/2, d+1);
@@ -49,29 +53,58 @@ void merge(long n, T left[n], T right[n], T result[n*2], long start, long length
         }
 }
 
+// Merge-path merge: the output is split into parts segments of the same
+// length, each one merged by a single task. basicmerge() finds where its
+// segment starts in left and right by co-ranking (a binary search along the
+// merge path), so every task does the same amount of work whatever the
+// distribution of the data.
+void merge_path(long n, T left[n], T right[n], T result[n*2], int parts) {
+        for (int p = 0; p < parts; p++) {
+                long start = p * (2L*n) / parts;
+                long end = (p+1) * (2L*n) / parts;
+                PAR_TASK_CREATED;
+                #pragma omp task
+                PAR_TASK(basicmerge(n, left, right, result, start, end - start));
+        }
+        PAR_TASKWAIT;
+}
+
 void multisort(long n, T data[n], T tmp[n], int d) {
         if (n >= MIN_SORT_SIZE*4L) {
-                // Recursive decomposition	
-		if (!omp_in_final()) {
+                // Recursive decomposition, with tasks only for subvectors of
+                // at least BATCH base cases (see merge())
+		if (!omp_in_final() && n >= MIN_SORT_SIZE*4L*BATCH) {
+			PAR_TASK_CREATED;
 			#pragma omp task final (d >= CUTOFF)
-			multisort(n/4L, &data[0], &tmp[0], d+1);
+			PAR_TASK(multisort(n/4L, &data[0], &tmp[0], d+1));
+			PAR_TASK_CREATED;
 			#pragma omp task final (d >= CUTOFF)
-			multisort(n/4L, &data[n/4L], &tmp[n/4L], d+1);
+			PAR_TASK(multisort(n/4L, &data[n/4L], &tmp[n/4L], d+1));
+			PAR_TASK_CREATED;
 			#pragma omp task final (d >= CUTOFF)
-			multisort(n/4L, &data[n/2L], &tmp[n/2L], d+1);
+			PAR_TASK(multisort(n/4L, &data[n/2L], &tmp[n/2L], d+1));
+			PAR_TASK_CREATED;
 			#pragma omp task final (d >= CUTOFF)
-			multisort(n/4L, &data[3L*n/4L], &tmp[3L*n/4L], d+1);
-			#pragma omp taskwait
+			PAR_TASK(multisort(n/4L, &data[3L*n/4L], &tmp[3L*n/4L], d+1));
+			PAR_TASKWAIT;
 
+			PAR_TASK_CREATED;
 			#pragma omp task final (d >= CUTOFF)
-			merge(n/4L, &data[0], &data[n/4L], &tmp[0], 0, n/2L, d+1);
+			PAR_TASK(merge(n/4L, &data[0], &data[n/4L], &tmp[0], 0, n/2L, d+1));
+			PAR_TASK_CREATED;
 			#pragma omp task final (d >= CUTOFF)
-			merge(n/4L, &data[n/2L], &data[3L*n/4L], &tmp[n/2L], 0, n/2L, d+1);
-			#pragma omp taskwait
+			PAR_TASK(merge(n/4L, &data[n/2L], &data[3L*n/4L], &tmp[n/2L], 0, n/2L, d+1));
+			PAR_TASKWAIT;
             
-			#pragma omp task final (d >= CUTOFF)
-		    merge(n/2L, &tmp[0], &tmp[n/2L], &data[0], 0, n, d+1);
-			#pragma omp taskwait
+			// The last merge of the root is the serial tail of the sort, it
+			// is split in as many segments as threads
+			if (d == 0) merge_path(n/2L, &tmp[0], &tmp[n/2L], &data[0], omp_get_num_threads());
+			else {
+				PAR_TASK_CREATED;
+				#pragma omp task final (d >= CUTOFF)
+				PAR_TASK(merge(n/2L, &tmp[0], &tmp[n/2L], &data[0], 0, n, d+1));
+				PAR_TASKWAIT;
+			}
 		}
 		else {
 			multisort(n/4L, &data[0], &tmp[0], d+1);
@@ -88,21 +121,265 @@ void multisort(long n, T data[n], T tmp[n], int d) {
 	}
 }
 
-static void initialize(long length, T data[length]) {
-    long i;
-    for (i = 0; i < length; i++) {
-        if (i==0) {
-            data[i] = rand();
+// Same sort as multisort(), but the tasks of all the levels are created by
+// the caller (this function does not run inside a task), so they are all
+// siblings and dependences between them can be expressed with depend clauses
+// across levels: every merge starts as soon as its two inputs are ready,
+// instead of waiting for the whole level. The sorted part of the vector
+// starting at data[i] is represented by data[i] and the merged halves kept in
+// tmp by tmp[i]. Tasks are created at the same depths as in multisort():
+// subvectors deeper than CUTOFF, or with less than BATCH base cases of the
+// recursion, are sorted by a single final task with multisort(), so leaf
+// tasks are not created for every small subvector, and the merges of depth
+// CUTOFF are final. The caller has to
+// wait for the tasks, with a taskgroup or a taskwait.
+void multisort_dag(long n, T data[n], T tmp[n], int d) {
+        if (n >= MIN_SORT_SIZE*4L*BATCH && d <= CUTOFF) {
+                multisort_dag(n/4L, &data[0], &tmp[0], d+1);
+                multisort_dag(n/4L, &data[n/4L], &tmp[n/4L], d+1);
+                multisort_dag(n/4L, &data[n/2L], &tmp[n/2L], d+1);
+                multisort_dag(n/4L, &data[3L*n/4L], &tmp[3L*n/4L], d+1);
+
+                PAR_TASK_CREATED;
+                #pragma omp task depend(in: data[0], data[n/4L]) depend(out: tmp[0]) final(d >= CUTOFF)
+                PAR_TASK(merge(n/4L, &data[0], &data[n/4L], &tmp[0], 0, n/2L, d+1));
+                PAR_TASK_CREATED;
+                #pragma omp task depend(in: data[n/2L], data[3L*n/4L]) depend(out: tmp[n/2L]) final(d >= CUTOFF)
+                PAR_TASK(merge(n/4L, &data[n/2L], &data[3L*n/4L], &tmp[n/2L], 0, n/2L, d+1));
+
+                if (d == 0) {
+                        // Merge-path segments of the last merge, see merge_path()
+                        int parts = omp_get_num_threads();
+                        for (int p = 0; p < parts; p++) {
+                                long start = p * n / parts;
+                                long end = (p+1) * n / parts;
+                                PAR_TASK_CREATED;
+                                #pragma omp task depend(in: tmp[0], tmp[n/2L])
+                                PAR_TASK(basicmerge(n/2L, &tmp[0], &tmp[n/2L], &data[0], start, end - start));
+                        }
+                }
+                else {
+                        PAR_TASK_CREATED;
+                        #pragma omp task depend(in: tmp[0], tmp[n/2L]) depend(out: data[0]) final(d >= CUTOFF)
+                        PAR_TASK(merge(n/2L, &tmp[0], &tmp[n/2L], &data[0], 0, n, d+1));
+                }
+        } else {
+                PAR_TASK_CREATED;
+                #pragma omp task depend(out: data[0]) final(1)
+                PAR_TASK(multisort(n, data, tmp, d));
+        }
+}
+
+// Low-memory mode: tmp only has N/LOWMEM_CHUNKS elements. The vector is
+// sorted in LOWMEM_CHUNKS chunks, one after the other and each one with the
+// tasks of multisort_dag(), and then the chunks are merged in place.
+#define LOWMEM_CHUNKS 8
+#define LOWMEM_GRAIN (64*1024L)     /* elements per task of a rotation */
+
+T *lowmem_buffer;                   // tmp, a slice of lowmem_slice elements per thread
+long lowmem_slice;
+
+static void reverse(long n, T data[n]) {
+        #pragma omp taskloop if (n > 2*LOWMEM_GRAIN && !omp_in_final()) grainsize(LOWMEM_GRAIN)
+        for (long i = 0; i < n/2; i++) {
+                T t = data[i]; data[i] = data[n-1-i]; data[n-1-i] = t;
+        }
+}
+
+// data[0..m) data[m..m+k) -> data[m..m+k) data[0..m)
+static void rotate(long m, long k, T data[m+k]) {
+        reverse(m, &data[0]);
+        reverse(k, &data[m]);
+        reverse(m+k, &data[0]);
+}
+
+// Merge data[0..a) and data[a..a+b) using buffer, with room for the
+// shorter of the two runs
+static void buffered_merge(long a, long b, T data[a+b], T buffer[]) {
+        if (a <= b) {
+                memcpy(buffer, data, a*sizeof(T));
+                long i = 0, j = a, k = 0;
+                while (i < a && j < a+b) data[k++] = LESS(data[j], buffer[i]) ? data[j++] : buffer[i++];
+                memcpy(&data[k], &buffer[i], (a-i)*sizeof(T));
+        } else {
+                memcpy(buffer, &data[a], b*sizeof(T));
+                long i = a-1, j = b-1, k = a+b-1;
+                while (i >= 0 && j >= 0) data[k--] = LESS(buffer[j], data[i]) ? data[i--] : buffer[j--];
+                memcpy(&data[0], &buffer[0], (j+1)*sizeof(T));
+        }
+}
+
+// Merge the sorted runs data[0..a) and data[a..a+b) in place: the middle
+// element of the longer run is located in the other one, the two inner parts
+// are swapped with a rotation and both halves are merged recursively. When
+// one of the runs fits in the slice of tmp of the thread, it is merged with
+// buffered_merge().
+void merge_inplace(long a, long b, T data[a+b], int d) {
+        if (a == 0 || b == 0) return;
+        if (a <= lowmem_slice || b <= lowmem_slice) {
+                buffered_merge(a, b, data, &lowmem_buffer[omp_get_thread_num() * lowmem_slice]);
+                return;
+        }
+
+        long i, j, lo, hi;
+        if (a >= b) {
+                // Elements of the second run smaller than data[i]
+                i = a/2;
+                for (lo = 0, hi = b; lo < hi; ) {
+                        long mid = (lo + hi) / 2;
+                        if (LESS(data[a+mid], data[i])) lo = mid + 1; else hi = mid;
+                }
+                j = lo;
         } else {
-            data[i] = ((data[i-1]+1) * i * 104723L) % N;
+                // Elements of the first run not greater than data[a+j]
+                j = b/2;
+                for (lo = 0, hi = a; lo < hi; ) {
+                        long mid = (lo + hi) / 2;
+                        if (!LESS(data[a+j], data[mid])) lo = mid + 1; else hi = mid;
+                }
+                i = lo;
         }
+        rotate(a - i, j, &data[i]);
+
+        if (!omp_in_final()) {
+                #pragma omp task final (d >= CUTOFF)
+                merge_inplace(i, j, &data[0], d+1);
+                #pragma omp task final (d >= CUTOFF)
+                merge_inplace(a - i, b - j, &data[i+j], d+1);
+                #pragma omp taskwait
+        }
+        else {
+                merge_inplace(i, j, &data[0], d+1);
+                merge_inplace(a - i, b - j, &data[i+j], d+1);
+        }
+}
+
+// Low-memory sort of data, with tmp of n/LOWMEM_CHUNKS elements
+void multisort_lowmem(long n, T data[n], T tmp[n/LOWMEM_CHUNKS]) {
+        long chunk = n / LOWMEM_CHUNKS;
+        for (long c = 0; c < n; c += chunk) {
+                #pragma omp taskgroup
+                multisort_dag(chunk, &data[c], tmp, 0);
+        }
+
+        lowmem_buffer = tmp;
+        lowmem_slice = chunk / omp_get_num_threads();
+        for (long run = chunk; run < n; run *= 2) {
+                for (long c = 0; c < n; c += 2*run) {
+                        #pragma omp task
+                        merge_inplace(run, run, &data[c], 0);
+                }
+                #pragma omp taskwait
+        }
+}
+
+#ifdef SORT_INTEGER_KEY
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MIN_SIZE (64*1024L)   /* smaller vectors are sorted with multisort */
+#define RADIX_WC (sizeof(T) < 64 ? 64/sizeof(T) : 1)    /* elements per write-combining buffer */
+
+// Key of x as an unsigned number with the same order (the sign bit is flipped)
+#define RADIX_KEY(x) ((unsigned long) KEY(x) ^ (1UL << (8*sizeof(KEY(x)) - 1)))
+
+// LSD radix sort of data, with digits of RADIX_BITS bits and tmp as the
+// ping-pong buffer. Each thread counts the digits of its part of the vector,
+// a prefix sum gives every thread its position in each bucket and then the
+// elements are scattered, going through a small buffer per bucket so that
+// whole cache lines are written at once. Digits that are the same for all
+// keys are skipped.
+void radixsort(long n, T data[n], T tmp[n]) {
+    const int bits = 8*sizeof(KEY(data[0]));
+    unsigned long first = RADIX_KEY(data[0]), diff = 0;
+    long *count = malloc(omp_get_max_threads() * RADIX_BUCKETS * sizeof(long));
+    T *src = data, *dst = tmp;
+
+    #pragma omp parallel for reduction(|:diff)
+    for (long i = 0; i < n; i++)
+        diff |= RADIX_KEY(data[i]) ^ first;
+
+    for (int shift = 0; shift < bits; shift += RADIX_BITS) {
+        if (((diff >> shift) & (RADIX_BUCKETS - 1)) == 0) continue;
+
+        #pragma omp parallel
+        {
+            int t = omp_get_thread_num(), nt = omp_get_num_threads();
+            long begin = n * t / nt, end = n * (t+1) / nt;
+            long *c = &count[t * RADIX_BUCKETS];
+
+            memset(c, 0, RADIX_BUCKETS * sizeof(long));
+            for (long i = begin; i < end; i++)
+                c[(RADIX_KEY(src[i]) >> shift) & (RADIX_BUCKETS - 1)]++;
+            #pragma omp barrier
+
+            // Buckets in order, and the threads in order within each bucket
+            #pragma omp single
+            {
+                long offset = 0;
+                for (int b = 0; b < RADIX_BUCKETS; b++)
+                    for (int u = 0; u < nt; u++) {
+                        long size = count[u * RADIX_BUCKETS + b];
+                        count[u * RADIX_BUCKETS + b] = offset;
+                        offset += size;
+                    }
+            }
+
+            T (*buffer)[RADIX_WC] = malloc(RADIX_BUCKETS * sizeof(*buffer));
+            int fill[RADIX_BUCKETS] = { 0 };
+            for (long i = begin; i < end; i++) {
+                int b = (RADIX_KEY(src[i]) >> shift) & (RADIX_BUCKETS - 1);
+                buffer[b][fill[b]++] = src[i];
+                if (fill[b] == RADIX_WC) {
+                    memcpy(&dst[c[b]], buffer[b], RADIX_WC * sizeof(T));
+                    c[b] += RADIX_WC;
+                    fill[b] = 0;
+                }
+            }
+            for (int b = 0; b < RADIX_BUCKETS; b++)
+                memcpy(&dst[c[b]], buffer[b], fill[b] * sizeof(T));
+            free(buffer);
+        }
+
+        T *swap = src; src = dst; dst = swap;
     }
+
+    if (src != data) {
+        #pragma omp parallel for
+        for (long i = 0; i < n; i++) data[i] = src[i];
+    }
+    free(count);
 }
+#endif
+
+// Element i of the vector, from a counter-based generator (splitmix64 on
+// seed + i), so any part of the vector can be generated independently and
+// the vector is the same whatever the number of threads
+unsigned long seed;
 
-static void clear(long length, T data[length]) {
-    long i;
-    for (i = 0; i < length; i++) {
-        data[i] = 0;
+static inline long element(long i) {
+    unsigned long x = seed + i + 0x9e3779b97f4a7c15UL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+    return (x ^ (x >> 31)) % N;
+}
+
+// Generate data, elements start .. start+length-1 of the vector, and clear
+// tmp. The vector is split with the same tasks as multisort_dag(), so the
+// pages of both buffers are first touched by the threads (and placed in the
+// NUMA nodes) that sort each part of them.
+static void initialize(long length, T data[length], T tmp[length], long start, int d) {
+    if (length >= MIN_SORT_SIZE*4L*BATCH && d <= CUTOFF) {
+        for (int q = 0; q < 4; q++) {
+            PAR_TASK_CREATED;
+            #pragma omp task
+            PAR_TASK(initialize(length/4L, &data[q*length/4L], &tmp[q*length/4L], start + q*length/4L, d+1));
+        }
+        PAR_TASKWAIT;
+    } else {
+        for (long i = 0; i < length; i++) {
+            SET_KEY(data[i], element(start + i), start + i);
+            SET_KEY(tmp[i], 0, 0);
+        }
     }
 }
 
@@ -110,9 +387,117 @@ void check_sorted(long n, T data[n])
 {
     int unsorted=0;
     for (int i=1; i<n; i++)
-        if (data[i-1] > data[i]) unsorted++;
+        if (LESS(data[i], data[i-1])) unsorted++;
     if (unsorted > 0)
         printf ("\nERROR: data is NOT properly sorted. There are %d unordered positions\n\n",unsorted);
+#ifdef SORT_PAIR
+    // The indices have to follow their keys: the records (here just the
+    // generated keys) moved by the sorted pairs are in the order of the keys
+    long *records = malloc(n*sizeof(long)), *sorted = malloc(n*sizeof(long));
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < n; i++) records[i] = element(i);
+    record_permute(n, sizeof(long), records, sorted, data);
+    long misplaced = 0;
+    #pragma omp parallel for reduction(+:misplaced)
+    for (long i = 0; i < n; i++)
+        if (sorted[i] != KEY(data[i])) misplaced++;
+    if (misplaced > 0)
+        printf ("\nERROR: indices do not follow their keys. There are %ld misplaced records\n\n",misplaced);
+    free(records);
+    free(sorted);
+#endif
+}
+
+#define TUNE_SIZE (2048*1024L)     /* elements of the calibration sorts */
+
+// Time of the calibration sort with the current parameters
+static double tune_run(long n, T data[n], T tmp[n]) {
+    #pragma omp parallel
+    #pragma omp single
+    initialize(n, data, tmp, 0, 0);
+    double start = getusec_();
+    #pragma omp parallel
+    #pragma omp single
+    #pragma omp taskgroup
+    multisort_dag(n, data, tmp, 0);
+    return getusec_() - start;
+}
+
+// Fastest of the values of *param in candidates, with the other parameters fixed
+static long tune_param(long *param, int count, long candidates[count], long n, T data[n], T tmp[n]) {
+    double best_time = 0;
+    long best = *param;
+    for (int i = 0; i < count; i++) {
+        *param = candidates[i];
+        double time = tune_run(n, data, tmp);
+        if (i == 0 || time < best_time) {
+            best_time = time;
+            best = candidates[i];
+        }
+    }
+    return *param = best;
+}
+
+// Choose MIN_SORT_SIZE, MIN_MERGE_SIZE and CUTOFF for this host and number
+// of threads. They are read from the profile file if it exists, otherwise
+// they are found with short calibration sorts and saved in the profile:
+//   - leaf sizes are tried from the largest power of two whose base case
+//     (less than 4*MIN_SORT_SIZE elements, plus as many of scratch) fits in L2,
+//   - cutoffs are tried from the first depth that creates 4 sort tasks per
+//     thread.
+// The name of the profile is written to profile (of size bytes). Returns 1
+// if the parameters were read from the profile.
+int autotune(char *profile, size_t size) {
+    char host[64] = "unknown";
+    const char *home = getenv("HOME");
+    gethostname(host, sizeof(host));
+    host[sizeof(host) - 1] = 0;     // not terminated if the name is truncated
+    snprintf(profile, size, "%s/.multisort-%s-%d-%zu.tune", home ? home : ".", host, omp_get_max_threads(), sizeof(T));
+
+    long s, m;
+    int c;
+    FILE *fp = fopen(profile, "r");
+    if (fp != NULL) {
+        int read = fscanf(fp, "%ld %ld %d", &s, &m, &c);
+        fclose(fp);
+        if (read == 3 && s > 0 && m > 0 && c >= 0) {
+            MIN_SORT_SIZE = s;
+            MIN_MERGE_SIZE = m;
+            CUTOFF = c;
+            return 1;
+        }
+    }
+
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 <= 0) l2 = 256*1024;
+    long leaf = 1;
+    while (leaf * 2 * 4 * (long) sizeof(T) <= l2) leaf *= 2;
+    int depth = 0;
+    for (long tasks = 1; tasks < 4L * omp_get_max_threads(); tasks *= 4) depth++;
+
+    long n = (N < TUNE_SIZE) ? N : TUNE_SIZE;
+    T *data = malloc(n*sizeof(T));
+    T *tmp = malloc(n*sizeof(T));
+    long sizes[3] = { leaf, leaf/4 > 0 ? leaf/4 : 1, leaf/16 > 0 ? leaf/16 : 1 };
+    long cutoffs[3] = { depth, depth+1, depth+2 };
+    long cutoff = depth+1;
+
+    MIN_SORT_SIZE = MIN_MERGE_SIZE = leaf;
+    CUTOFF = cutoff;
+    tune_run(n, data, tmp);         // warm up
+
+    tune_param(&MIN_SORT_SIZE, 3, sizes, n, data, tmp);
+    tune_param(&MIN_MERGE_SIZE, 3, sizes, n, data, tmp);
+    CUTOFF = tune_param(&cutoff, 3, cutoffs, n, data, tmp);
+    free(data);
+    free(tmp);
+
+    fp = fopen(profile, "w");
+    if (fp != NULL) {
+        fprintf(fp, "%ld %ld %d\n", MIN_SORT_SIZE, MIN_MERGE_SIZE, CUTOFF);
+        fclose(fp);
+    }
+    return 0;
 }
 
 int main(int argc, char **argv) {
@@ -123,6 +508,7 @@ int main(int argc, char **argv) {
     MIN_SORT_SIZE = 1024;
     MIN_MERGE_SIZE = 1024;
     CUTOFF = 16;
+    BATCH = 4;
 
     /* Process command-line arguments */
     for (int i=1; i<argc; i++) {
@@ -135,6 +521,18 @@ int main(int argc, char **argv) {
         else if (strcmp(argv[i], "-m")==0) {
             MIN_MERGE_SIZE = atol(argv[++i]);
         }
+        else if (strcmp(argv[i], "-b")==0) {
+            BATCH = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r")==0) {
+            radix = 1;
+        }
+        else if (strcmp(argv[i], "-a")==0) {
+            tune = 1;
+        }
+        else if (strcmp(argv[i], "-l")==0) {
+            lowmem = 1;
+        }
 #ifdef _OPENMP
         else if (strcmp(argv[i], "-c")==0) {
             CUTOFF = atoi(argv[++i]);
@@ -142,50 +540,92 @@ int main(int argc, char **argv) {
 #endif
         else {
 #ifdef _OPENMP
-            fprintf(stderr, "Usage: %s [-n vector_size -s MIN_SORT_SIZE -m MIN_MERGE_SIZE] -c CUTOFF\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-n vector_size -s MIN_SORT_SIZE -m MIN_MERGE_SIZE -b BATCH -r -a -l] -c CUTOFF\n", argv[0]);
 #else
-            fprintf(stderr, "Usage: %s [-n vector_size -s MIN_SORT_SIZE -m MIN_MERGE_SIZE]\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-n vector_size -s MIN_SORT_SIZE -m MIN_MERGE_SIZE -b BATCH -r -a -l]\n", argv[0]);
 #endif
             fprintf(stderr, "       -n to specify the size of the vector (in Kelements) to sort (default 32768)\n");
             fprintf(stderr, "       -s to specify the size of the vector (in elements) that breaks recursion in the sort phase (default 1024)\n");
             fprintf(stderr, "       -m to specify the size of the vector (in elements) that breaks recursion in the merge phase (default 1024)\n");
+            fprintf(stderr, "       -b to specify the number of base cases done by each leaf task (default 4)\n");
+            fprintf(stderr, "       -r to sort with radix sort instead of multisort (integer keys only)\n");
+            fprintf(stderr, "       -a to auto-tune -s, -m and -c for this host (saved in ~/.multisort-*.tune, delete it to tune again)\n");
+            fprintf(stderr, "       -l to sort with a temporary vector of N/%d elements, merging in place\n", LOWMEM_CHUNKS);
 #ifdef _OPENMP
             fprintf(stderr, "       -c to specify the cut off recursion level to stop task generation in OpenMP (default 16)\n");
 #endif
             return EXIT_FAILURE;
         }
     }
+    if (BATCH < 1) {
+        fprintf(stderr, "The number of base cases per leaf task (%ld) has to be at least 1\n", BATCH);
+        return EXIT_FAILURE;
+    }
+
+    seed = rand();
+    char profile[4096];
+    int cached = tune ? autotune(profile, sizeof(profile)) : 0;
 
     fprintf(stdout, "*****************************************************************************************\n");
     fprintf(stdout, "Problem size (in number of elements): N=%ld, MIN_SORT_SIZE=%ld, MIN_MERGE_SIZE=%ld\n", N/1024, MIN_SORT_SIZE, MIN_MERGE_SIZE);
 #ifdef _OPENMP
     fprintf(stdout, "Cut-off level:                        CUTOFF=%d\n", CUTOFF);
+    fprintf(stdout, "Base cases per leaf task:             BATCH=%ld\n", BATCH);
     fprintf(stdout, "Number of threads in OpenMP:          OMP_NUM_THREADS=%d\n", omp_get_max_threads());
 #endif
+#ifdef SORT_INTEGER_KEY
+    if (radix && N < RADIX_MIN_SIZE) radix = 0;
+#else
+    radix = 0;
+#endif
+    if (lowmem && (radix || N / LOWMEM_CHUNKS < omp_get_max_threads())) lowmem = 0;
+    if (tune) fprintf(stdout, "Auto-tuned parameters:                %s %s\n", cached ? "read from" : "saved in", profile);
+    fprintf(stdout, "Sorting algorithm:                    %s\n", radix ? "radix sort" : lowmem ? "multisort, low memory" : "multisort");
     fprintf(stdout, "*****************************************************************************************\n");
 
     T *data = malloc(N*sizeof(T));
-    T *tmp = malloc(N*sizeof(T));
+    T *tmp = malloc((lowmem ? N/LOWMEM_CHUNKS : N)*sizeof(T));
 
     double stamp;
     START_COUNT_TIME;
+    PAR_PHASE_BEGIN("initialize");
 
-    initialize(N, data);
-    clear(N, tmp);
+    #pragma omp parallel
+    #pragma omp single
+    {
+    if (lowmem)
+        for (long c = 0; c < N; c += N/LOWMEM_CHUNKS) initialize(N/LOWMEM_CHUNKS, &data[c], tmp, c, 0);
+    else initialize(N, data, tmp, 0, 0);
+    }
 
+    PAR_PHASE_END;
     STOP_COUNT_TIME("Initialization time in seconds");
 
     START_COUNT_TIME;
+    PAR_PHASE_BEGIN("sort");
+#ifdef SORT_INTEGER_KEY
+    if (radix) radixsort(N, data, tmp);
+    else
+#endif
+    {
     #pragma omp parallel
     #pragma omp single
-    multisort(N, data, tmp, 0);
+    if (lowmem) multisort_lowmem(N, data, tmp);
+    else {
+    #pragma omp taskgroup
+    multisort_dag(N, data, tmp, 0);
+    }
+    }
 
+    PAR_PHASE_END;
     STOP_COUNT_TIME("Multisort execution time");
 
     START_COUNT_TIME;
+    PAR_PHASE_BEGIN("check");
 
     check_sorted (N, data);
 
+    PAR_PHASE_END;
     STOP_COUNT_TIME("Check sorted data execution time");
 
     fprintf(stdout, "Multisort program finished\n");
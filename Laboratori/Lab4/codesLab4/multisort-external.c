@@ -0,0 +1,424 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "omp.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "../../common/par-timing.h"
+
+#define START_COUNT_TIME stamp = getusec_();
+#define STOP_COUNT_TIME(_m) stamp = getusec_() - stamp;\
+                                    stamp = stamp/1e6;\
+                                    printf ("%s: %0.6f\n",(_m), stamp);\
+                                    par_timing_record((_m), stamp);
+
+// N and MIN must be powers of 2
+long N;
+long MIN_SORT_SIZE;
+long MIN_MERGE_SIZE;
+int CUTOFF;
+
+#include "multisort-type.h"
+
+void basicsort(long n, T data[n]);
+
+void basicmerge(long n, T left[n], T right[n], T result[n*2], long start, long length);
+
+void merge(long n, T left[n], T right[n], T result[n*2], long start, long length, int d) {
+        if (length < MIN_MERGE_SIZE*2L) {
+                // Base case
+                basicmerge(n, left, right, result, start, length);
+        } else {
+                // Recursive decomposition
+                if (!omp_in_final()) {
+                  #pragma omp task final (d >= CUTOFF)
+                  merge(n, left, right, result, start, length/2, d+1);
+                  #pragma omp task final (d >= CUTOFF)
+                  merge(n, left, right, result, start + length/2, length/2, d+1);
+                  #pragma omp taskwait	
+                }
+                else {
+                  merge(n, left, right, result, start, length/2, d+1);
+                  merge(n, left, right, result, start + length/2, length/2, d+1);
+                }
+        }
+}
+
+// Merge-path merge: the output is split into parts segments of the same
+// length, each one merged by a single task. basicmerge() finds where its
+// segment starts in left and right by co-ranking (a binary search along the
+// merge path), so every task does the same amount of work whatever the
+// distribution of the data.
+void merge_path(long n, T left[n], T right[n], T result[n*2], int parts) {
+        for (int p = 0; p < parts; p++) {
+                long start = p * (2L*n) / parts;
+                long end = (p+1) * (2L*n) / parts;
+                #pragma omp task
+                basicmerge(n, left, right, result, start, end - start);
+        }
+        #pragma omp taskwait
+}
+
+void multisort(long n, T data[n], T tmp[n], int d) {
+        if (n >= MIN_SORT_SIZE*4L) {
+                // Recursive decomposition	
+		if (!omp_in_final()) {
+			#pragma omp task final (d >= CUTOFF)
+			multisort(n/4L, &data[0], &tmp[0], d+1);
+			#pragma omp task final (d >= CUTOFF)
+			multisort(n/4L, &data[n/4L], &tmp[n/4L], d+1);
+			#pragma omp task final (d >= CUTOFF)
+			multisort(n/4L, &data[n/2L], &tmp[n/2L], d+1);
+			#pragma omp task final (d >= CUTOFF)
+			multisort(n/4L, &data[3L*n/4L], &tmp[3L*n/4L], d+1);
+			#pragma omp taskwait
+
+			#pragma omp task final (d >= CUTOFF)
+			merge(n/4L, &data[0], &data[n/4L], &tmp[0], 0, n/2L, d+1);
+			#pragma omp task final (d >= CUTOFF)
+			merge(n/4L, &data[n/2L], &data[3L*n/4L], &tmp[n/2L], 0, n/2L, d+1);
+			#pragma omp taskwait
+            
+			// The last merge of the root is the serial tail of the sort, it
+			// is split in as many segments as threads
+			if (d == 0) merge_path(n/2L, &tmp[0], &tmp[n/2L], &data[0], omp_get_num_threads());
+			else {
+				#pragma omp task final (d >= CUTOFF)
+				merge(n/2L, &tmp[0], &tmp[n/2L], &data[0], 0, n, d+1);
+				#pragma omp taskwait
+			}
+		}
+		else {
+			multisort(n/4L, &data[0], &tmp[0], d+1);
+			multisort(n/4L, &data[n/4L], &tmp[n/4L], d+1);
+			multisort(n/4L, &data[n/2L], &tmp[n/2L], d+1);
+			multisort(n/4L, &data[3L*n/4L], &tmp[3L*n/4L], d+1);
+			merge(n/4L, &data[0], &data[n/4L], &tmp[0], 0, n/2L, d+1);
+			merge(n/4L, &data[n/2L], &data[3L*n/4L], &tmp[n/2L], 0, n/2L, d+1);
+		    merge(n/2L, &tmp[0], &tmp[n/2L], &data[0], 0, n, d+1);
+		}
+	} else {
+		// Base case	
+		basicsort(n, data);
+	}
+}
+
+// External sort: the vector is generated and sorted in runs of RUN_SIZE
+// elements, which are spilled to a temporary file, and the runs are then
+// merged into the output file. Writing a run to disk overlaps with the
+// generation and sort of the next one, and writing a block of the output
+// overlaps with merging the next one.
+long RUN_SIZE;
+char *output_name = "multisort.out";
+char *run_dir = ".";
+
+#define OUT_BLOCK (1024*1024L)      /* elements per output buffer */
+#define PREFETCH (1024*1024L)       /* bytes read ahead in each run */
+
+// Element i of the vector, from a counter-based generator (splitmix64 on
+// seed + i), so any part of the vector can be generated independently and
+// the vector is the same whatever the number of threads
+unsigned long seed;
+
+static inline long element(long i) {
+    unsigned long x = seed + i + 0x9e3779b97f4a7c15UL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+    return (x ^ (x >> 31)) % N;
+}
+
+// Generate data, elements start .. start+length-1 of the vector, and clear
+// tmp if it is not NULL. The run is split with the same tasks as
+// multisort(), so the pages of the buffers are first touched by the threads
+// (and placed in the NUMA nodes) that sort each part of them.
+static void initialize(long length, T data[length], T *tmp, long start, int d) {
+    if (length >= MIN_SORT_SIZE*4L && d <= CUTOFF) {
+        for (int q = 0; q < 4; q++) {
+            #pragma omp task
+            initialize(length/4L, &data[q*length/4L], tmp ? &tmp[q*length/4L] : NULL, start + q*length/4L, d+1);
+        }
+        #pragma omp taskwait
+    } else {
+        for (long i = 0; i < length; i++) {
+            SET_KEY(data[i], element(start + i), start + i);
+            if (tmp != NULL) SET_KEY(tmp[i], 0, 0);
+        }
+    }
+}
+
+// Write all of buffer at offset of the file, returns 0 in case of error
+static int write_all(int fd, const void *buffer, size_t bytes, off_t offset) {
+    const char *p = buffer;
+    while (bytes > 0) {
+        ssize_t w = pwrite(fd, p, bytes, offset);
+        if (w <= 0) return 0;
+        p += w; bytes -= w; offset += w;
+    }
+    return 1;
+}
+
+// Sort the vector in runs of RUN_SIZE elements into file fd
+int sort_runs(int fd) {
+    T *data[2], *tmp;
+    int ok = 1;
+
+    data[0] = malloc(RUN_SIZE*sizeof(T));
+    data[1] = malloc(RUN_SIZE*sizeof(T));
+    tmp = malloc(RUN_SIZE*sizeof(T));
+
+    #pragma omp parallel
+    #pragma omp single
+    {
+        for (long r = 0; r < N / RUN_SIZE; r++) {
+            T *run = data[r % 2];
+
+            // The previous run is written while this one is sorted
+            if (r > 0) {
+                T *last = data[(r-1) % 2];
+                #pragma omp task firstprivate(r, last)
+                if (!write_all(fd, last, RUN_SIZE*sizeof(T), (off_t) (r-1) * RUN_SIZE * sizeof(T))) ok = 0;
+            }
+
+            // Generated in a task of its own, so that only its tasks are
+            // waited for and not the write. tmp is cleared with the first run.
+            #pragma omp taskgroup
+            {
+                #pragma omp task
+                initialize(RUN_SIZE, run, r == 0 ? tmp : NULL, r * RUN_SIZE, 0);
+            }
+
+            #pragma omp task
+            multisort(RUN_SIZE, run, tmp, 0);
+            #pragma omp taskwait
+        }
+        long r = N / RUN_SIZE - 1;
+        if (!write_all(fd, data[r % 2], RUN_SIZE*sizeof(T), (off_t) r * RUN_SIZE * sizeof(T))) ok = 0;
+    }
+
+    free(data[0]); free(data[1]); free(tmp);
+    return ok;
+}
+
+typedef struct {
+    T *next, *end;
+    char *prefetched;               // end of the part of the run already read ahead
+    char *released;                 // start of the pages of the run still mapped
+} run_cursor;
+
+static inline int run_less(run_cursor *run, int a, int b) {
+    return LESS(*run[a].next, *run[b].next) || (!LESS(*run[b].next, *run[a].next) && a < b);
+}
+
+static void sift_down(run_cursor *run, int *heap, int size, int i) {
+    for (;;) {
+        int c = 2*i + 1;
+        if (c >= size) break;
+        if (c + 1 < size && run_less(run, heap[c+1], heap[c])) c++;
+        if (!run_less(run, heap[c], heap[i])) break;
+        int t = heap[i]; heap[i] = heap[c]; heap[c] = t;
+        i = c;
+    }
+}
+
+// Ask the kernel to read ahead the next PREFETCH bytes of the run when half
+// of the part already read ahead has been merged, and drop the pages of the
+// run that have been merged (they are not read again)
+static void prefetch_run(run_cursor *run, long page) {
+    char *next = (char *) run->next, *end = (char *) run->end;
+    if (run->prefetched >= end || next + PREFETCH/2 < run->prefetched) return;
+
+    long bytes = (end - run->prefetched < PREFETCH) ? end - run->prefetched : PREFETCH;
+    madvise(run->prefetched, bytes, MADV_WILLNEED);
+    run->prefetched += bytes;
+
+    char *done = run->released + (next - run->released) / page * page;
+    if (done > run->released) madvise(run->released, done - run->released, MADV_DONTNEED);
+    run->released = done;
+}
+
+// k-way merge of the runs in file fd into file out
+int merge_runs(int fd, FILE *out) {
+    int k = N / RUN_SIZE, size = k, ok = 1;
+    long page = sysconf(_SC_PAGESIZE);
+    T *map = mmap(NULL, N*sizeof(T), PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return 0;
+    madvise(map, N*sizeof(T), MADV_SEQUENTIAL);
+
+    run_cursor *run = malloc(k * sizeof(run_cursor));
+    int *heap = malloc(k * sizeof(int));
+    for (int r = 0; r < k; r++) {
+        run[r].next = &map[r * RUN_SIZE];
+        run[r].end = &map[(r+1) * RUN_SIZE];
+        run[r].prefetched = run[r].released = (char *) run[r].next;
+        prefetch_run(&run[r], page);
+        heap[r] = r;
+    }
+    for (int i = k/2 - 1; i >= 0; i--) sift_down(run, heap, size, i);
+
+    T *buffer[2];
+    buffer[0] = malloc(OUT_BLOCK*sizeof(T));
+    buffer[1] = malloc(OUT_BLOCK*sizeof(T));
+
+    #pragma omp parallel num_threads(2)
+    #pragma omp single
+    {
+        int b = 0;
+        while (size > 0) {
+            long fill = 0;
+            T *o = buffer[b];
+            while (fill < OUT_BLOCK && size > 0) {
+                int r = heap[0];
+                o[fill++] = *run[r].next++;
+                if (run[r].next == run[r].end) heap[0] = heap[--size];
+                else prefetch_run(&run[r], page);
+                sift_down(run, heap, size, 0);
+            }
+
+            // The other buffer is free once its write has finished, and this
+            // one is written while the next block is merged
+            #pragma omp taskwait
+            #pragma omp task firstprivate(o, fill)
+            if (fwrite(o, sizeof(T), fill, out) != (size_t) fill) ok = 0;
+            b ^= 1;
+        }
+        #pragma omp taskwait
+    }
+
+    free(buffer[0]); free(buffer[1]);
+    free(run); free(heap);
+    munmap(map, N*sizeof(T));
+    return ok;
+}
+
+// Number of unordered positions of the n elements in file fp
+long check_sorted_file(FILE *fp, long n) {
+    T *map = mmap(NULL, n*sizeof(T), PROT_READ, MAP_SHARED, fileno(fp), 0);
+    if (map == MAP_FAILED) return n;
+    madvise(map, n*sizeof(T), MADV_SEQUENTIAL);
+
+    long unsorted = 0;
+    #pragma omp parallel for reduction(+:unsorted)
+    for (long i = 1; i < n; i++)
+        if (LESS(map[i], map[i-1])) unsorted++;
+    munmap(map, n*sizeof(T));
+    return unsorted;
+}
+
+int main(int argc, char **argv) {
+
+    /* Defaults for command line arguments */
+    /* Important: all of them should be powers of two */
+    N = 32768 * 1024;
+    RUN_SIZE = 4096 * 1024;
+    MIN_SORT_SIZE = 1024;
+    MIN_MERGE_SIZE = 1024;
+    CUTOFF = 16;
+
+    /* Process command-line arguments */
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-n")==0) {
+            N = atol(argv[++i]) * 1024;
+        }
+        else if (strcmp(argv[i], "-r")==0) {
+            RUN_SIZE = atol(argv[++i]) * 1024;
+        }
+        else if (strcmp(argv[i], "-s")==0) {
+            MIN_SORT_SIZE = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-m")==0) {
+            MIN_MERGE_SIZE = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o")==0) {
+            output_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "-d")==0) {
+            run_dir = argv[++i];
+        }
+#ifdef _OPENMP
+        else if (strcmp(argv[i], "-c")==0) {
+            CUTOFF = atoi(argv[++i]);
+        }
+#endif
+        else {
+#ifdef _OPENMP
+            fprintf(stderr, "Usage: %s [-n vector_size -r run_size -s MIN_SORT_SIZE -m MIN_MERGE_SIZE -o output -d directory] -c CUTOFF\n", argv[0]);
+#else
+            fprintf(stderr, "Usage: %s [-n vector_size -r run_size -s MIN_SORT_SIZE -m MIN_MERGE_SIZE -o output -d directory]\n", argv[0]);
+#endif
+            fprintf(stderr, "       -n to specify the size of the vector (in Kelements) to sort (default 32768)\n");
+            fprintf(stderr, "       -r to specify the size of the runs (in Kelements) sorted in memory (default 4096)\n");
+            fprintf(stderr, "       -s to specify the size of the vector (in elements) that breaks recursion in the sort phase (default 1024)\n");
+            fprintf(stderr, "       -m to specify the size of the vector (in elements) that breaks recursion in the merge phase (default 1024)\n");
+            fprintf(stderr, "       -o to specify the file where the sorted vector is written (default multisort.out)\n");
+            fprintf(stderr, "       -d to specify the directory for the temporary file with the runs (default .)\n");
+#ifdef _OPENMP
+            fprintf(stderr, "       -c to specify the cut off recursion level to stop task generation in OpenMP (default 16)\n");
+#endif
+            return EXIT_FAILURE;
+        }
+    }
+    if (RUN_SIZE > N) RUN_SIZE = N;
+    // All the runs are sorted by multisort(), so they have the same size
+    if (RUN_SIZE <= 0 || N % RUN_SIZE != 0) {
+        fprintf(stderr, "The vector size (%ld K) has to be a multiple of the run size (%ld K)\n", N/1024, RUN_SIZE/1024);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stdout, "*****************************************************************************************\n");
+    fprintf(stdout, "Problem size (in number of elements): N=%ld, MIN_SORT_SIZE=%ld, MIN_MERGE_SIZE=%ld\n", N/1024, MIN_SORT_SIZE, MIN_MERGE_SIZE);
+    fprintf(stdout, "Run size (in number of elements):     RUN_SIZE=%ld, %ld runs\n", RUN_SIZE/1024, N/RUN_SIZE);
+#ifdef _OPENMP
+    fprintf(stdout, "Cut-off level:                        CUTOFF=%d\n", CUTOFF);
+    fprintf(stdout, "Number of threads in OpenMP:          OMP_NUM_THREADS=%d\n", omp_get_max_threads());
+#endif
+    fprintf(stdout, "*****************************************************************************************\n");
+
+    seed = rand();
+
+    char *run_name = malloc(strlen(run_dir) + 32);
+    sprintf(run_name, "%s/multisort-runs-XXXXXX", run_dir);
+    int fd = mkstemp(run_name);
+    FILE *out = fopen(output_name, "w+b");
+    if (fd < 0 || out == NULL) {
+        fprintf(stderr, "Unable to create %s or %s\n", run_name, output_name);
+        return EXIT_FAILURE;
+    }
+    unlink(run_name);
+
+    double stamp;
+    START_COUNT_TIME;
+
+    if (!sort_runs(fd)) {
+        fprintf(stderr, "Unable to write the runs to %s\n", run_name);
+        return EXIT_FAILURE;
+    }
+
+    STOP_COUNT_TIME("Sort runs execution time");
+
+    START_COUNT_TIME;
+
+    if (!merge_runs(fd, out) || fflush(out) != 0) {
+        fprintf(stderr, "Unable to write the output to %s\n", output_name);
+        return EXIT_FAILURE;
+    }
+
+    STOP_COUNT_TIME("Merge runs execution time");
+
+    START_COUNT_TIME;
+
+    long unsorted = check_sorted_file(out, N);
+    if (unsorted > 0)
+        printf ("\nERROR: data is NOT properly sorted. There are %ld unordered positions\n\n",unsorted);
+
+    STOP_COUNT_TIME("Check sorted data execution time");
+
+    close(fd);
+    fclose(out);
+
+    fprintf(stdout, "Multisort program finished\n");
+    fprintf(stdout, "*****************************************************************************************\n");
+    return 0;
+}
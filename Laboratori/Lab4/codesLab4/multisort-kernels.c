@@ -0,0 +1,172 @@
+// Leaf kernels for the multisort programs: basicsort() and basicmerge()
+//
+// basicsort() sorts blocks of 64 elements as 8 vectors of 8 lanes with a
+// sorting network (each lane ends up sorted across the 8 vectors), transposes
+// them into 8 sorted runs of 8 elements, and builds longer runs with merge
+// passes. Merge passes go first within blocks of KERNEL_BLOCK elements, which
+// fit in L2, and then across blocks.
+//
+// Merges are branchless: the comparison selects the element to store and
+// advances one of the two indices, so there are no mispredicted branches
+// inside the loop. basicmerge() uses a co-ranking binary search to find where
+// the output segment [start, start+length) of the merge begins in both inputs.
+//
+// Vectors use the GCC vector extensions, so the network compiles to SSE2,
+// AVX2 or AVX-512 min/max instructions depending on the target flags. The
+// network is only used for T int (see multisort-type.h), for other types the
+// initial runs of 8 elements are sorted by insertion.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "multisort-type.h"
+
+#define KERNEL_LANES 8              /* lanes of the sorting network vectors */
+#define KERNEL_BLOCK (64*1024)      /* elements sorted within L2 before merging across blocks */
+
+#ifdef SORT_INT
+typedef T vec __attribute__ ((vector_size (KERNEL_LANES*sizeof(T))));
+
+// Compare-exchange lanes of a and b: a gets the minimums, b the maximums
+#define CMPXCHG(a, b) do { vec _lt = (vec) ((a) < (b)); vec _min = ((a) & _lt) | ((b) & ~_lt); \
+                           (b) = ((b) & _lt) | ((a) & ~_lt); (a) = _min; } while (0)
+
+// Sort 64 elements into 8 consecutive runs of 8 elements
+static void sort_block64(const T *in, T *out) {
+    vec r[8];
+    for (int v = 0; v < 8; ++v)
+        memcpy(&r[v], &in[v*KERNEL_LANES], sizeof(vec));
+
+    // Optimal 19 comparator network for 8 inputs, applied to all lanes at once
+    CMPXCHG(r[0], r[2]); CMPXCHG(r[1], r[3]); CMPXCHG(r[4], r[6]); CMPXCHG(r[5], r[7]);
+    CMPXCHG(r[0], r[4]); CMPXCHG(r[1], r[5]); CMPXCHG(r[2], r[6]); CMPXCHG(r[3], r[7]);
+    CMPXCHG(r[0], r[1]); CMPXCHG(r[2], r[3]); CMPXCHG(r[4], r[5]); CMPXCHG(r[6], r[7]);
+    CMPXCHG(r[2], r[4]); CMPXCHG(r[3], r[5]);
+    CMPXCHG(r[1], r[4]); CMPXCHG(r[3], r[6]);
+    CMPXCHG(r[1], r[2]); CMPXCHG(r[3], r[4]); CMPXCHG(r[5], r[6]);
+
+    // Transpose: lane l of all vectors is run l
+    for (int l = 0; l < KERNEL_LANES; ++l)
+        for (int v = 0; v < 8; ++v)
+            out[l*8 + v] = r[v][l];
+}
+#endif
+
+static void insertion_sort(long n, T data[n]) {
+    for (long i = 1; i < n; ++i) {
+        T x = data[i];
+        long j = i;
+        for (; j > 0 && LESS(x, data[j-1]); --j) data[j] = data[j-1];
+        data[j] = x;
+    }
+}
+
+// Branchless merge of a[0..na) and b[0..nb) into out, elements of a go first on ties
+static void merge_runs(long na, const T a[na], long nb, const T b[nb], T out[na+nb]) {
+    long i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        T x = a[i], y = b[j];
+        int take_b = LESS(y, x);
+        out[k++] = take_b ? y : x;
+        j += take_b;
+        i += !take_b;
+    }
+    memcpy(&out[k], &a[i], (na-i)*sizeof(T));
+    k += na-i;
+    memcpy(&out[k], &b[j], (nb-j)*sizeof(T));
+}
+
+// Merge consecutive runs of length run of src[0..n) into dst
+static void merge_pass(long n, const T src[n], T dst[n], long run) {
+    for (long i = 0; i < n; i += 2*run) {
+        long na = (i + run < n) ? run : n - i;
+        long nb = (i + 2*run < n) ? run : n - i - na;
+        merge_runs(na, &src[i], nb, &src[i+na], &dst[i]);
+    }
+}
+
+// Sort data[0..n) with runs of length run already sorted, using tmp as scratch.
+// Returns the buffer holding the result.
+static T *merge_sort_runs(long n, T data[n], T tmp[n], long run, long last_run) {
+    T *src = data, *dst = tmp;
+    for (; run < last_run && run < n; run *= 2) {
+        merge_pass(n, src, dst, run);
+        T *t = src; src = dst; dst = t;
+    }
+    return src;
+}
+
+// Scratch of basicsort(), one per thread. It is allocated the first time
+// the thread needs it and only grows, so basicsort() does not call malloc()
+// for every leaf of the sort and threads never share the allocator.
+static __thread T *scratch;
+static __thread long scratch_size;
+
+static T *kernel_scratch(long n) {
+    if (n > scratch_size) {
+        free(scratch);
+        scratch = malloc(n*sizeof(T));
+        scratch_size = n;
+    }
+    return scratch;
+}
+
+void basicsort(long n, T data[n]) {
+    if (n <= 64) {
+        insertion_sort(n, data);
+        return;
+    }
+
+    T *tmp = kernel_scratch(n);
+
+    // Sorted runs of 8 elements, a possible tail shorter than 64 is sorted as one run
+    long full = n / 64 * 64;
+    for (long i = 0; i < full; i += 64) {
+#ifdef SORT_INT
+        sort_block64(&data[i], &tmp[i]);
+        memcpy(&data[i], &tmp[i], 64*sizeof(T));
+#else
+        for (long j = i; j < i + 64; j += 8) insertion_sort(8, &data[j]);
+#endif
+    }
+    insertion_sort(n - full, &data[full]);
+
+    // Merge passes within each block of KERNEL_BLOCK elements, then across blocks
+    for (long b = 0; b < n; b += KERNEL_BLOCK) {
+        long nb = (b + KERNEL_BLOCK < n) ? KERNEL_BLOCK : n - b;
+        T *sorted = merge_sort_runs(nb, &data[b], &tmp[b], 8, nb);
+        if (sorted != &data[b]) memcpy(&data[b], sorted, nb*sizeof(T));
+    }
+    T *sorted = merge_sort_runs(n, data, tmp, KERNEL_BLOCK, n);
+    if (sorted != data) memcpy(data, sorted, n*sizeof(T));
+}
+
+// Number of elements of a among the first s elements of the merge of a and b
+// (co-rank), consistent with merge_runs() taking elements of a first on ties
+static long corank(long s, long na, const T a[na], long nb, const T b[nb]) {
+    long lo = (s > nb) ? s - nb : 0;
+    long hi = (s < na) ? s : na;
+    while (lo < hi) {
+        long i = (lo + hi) / 2;
+        if (!LESS(b[s-i-1], a[i])) lo = i + 1;
+        else hi = i;
+    }
+    return lo;
+}
+
+void basicmerge(long n, T left[n], T right[n], T result[n*2], long start, long length) {
+    long i = corank(start, n, left, n, right);
+    long j = start - i;
+    T *out = &result[start];
+    long k = 0;
+
+    while (k < length && i < n && j < n) {
+        T x = left[i], y = right[j];
+        int take_right = LESS(y, x);
+        out[k++] = take_right ? y : x;
+        j += take_right;
+        i += !take_right;
+    }
+    while (k < length && i < n) out[k++] = left[i++];
+    while (k < length && j < n) out[k++] = right[j++];
+}
@@ -11,7 +11,7 @@ long N;
 long MIN_SORT_SIZE;
 long MIN_MERGE_SIZE;
 
-#define T int
+#include "multisort-type.h"
 
 void basicsort(long n, T data[n]);
 
@@ -68,9 +68,9 @@ static void initialize(long length, T data[length]) {
     long i;
     for (i = 0; i < length; i++) {
         if (i==0) {
-            data[i] = rand();
+            SET_KEY(data[i], rand(), i);
         } else {
-            data[i] = ((data[i-1]+1) * i * 104723L) % N;
+            SET_KEY(data[i], ((KEY(data[i-1])+1) * i * 104723L) % N, i);
         }
     }
 }
@@ -78,7 +78,7 @@ static void initialize(long length, T data[length]) {
 static void clear(long length, T data[length]) {
     long i;
     for (i = 0; i < length; i++) {
-        data[i] = 0;
+        SET_KEY(data[i], 0, 0);
     }
 }
 
@@ -86,7 +86,7 @@ void check_sorted(long n, T data[n])
 {
     int unsorted=0;
     for (int i=1; i<n; i++)
-        if (data[i-1] > data[i]) unsorted++;
+        if (LESS(data[i], data[i-1])) unsorted++;
     if (unsorted > 0)
         printf ("\nERROR: data is NOT properly sorted. There are %d unordered positions\n\n",unsorted);
 }
@@ -5,17 +5,13 @@
 #include <unistd.h>
 #include "omp.h"
 
-#include <sys/time.h>
-double getusec_() {
-    struct timeval time;
-    gettimeofday(&time, NULL);
-    return ((double)time.tv_sec * (double)1e6 + (double)time.tv_usec);
-}
+#include "../../common/par-timing.h"
 
 #define START_COUNT_TIME stamp = getusec_();
 #define STOP_COUNT_TIME(_m) stamp = getusec_() - stamp;\
                                     stamp = stamp/1e6;\
-                                    printf ("%s: %0.6f\n",(_m), stamp);
+                                    printf ("%s: %0.6f\n",(_m), stamp);\
+                                    par_timing_record((_m), stamp);
 
 // N and MIN must be powers of 2
 long N;
@@ -23,7 +19,7 @@ long MIN_SORT_SIZE;
 long MIN_MERGE_SIZE;
 int CUTOFF;
 
-#define T int
+#include "multisort-type.h"
 
 void basicsort(long n, T data[n]);
 
@@ -73,21 +69,34 @@ void multisort(long n, T data[n], T tmp[n]) {
     }
 }
 
-static void initialize(long length, T data[length]) {
-    long i;
-    for (i = 0; i < length; i++) {
-        if (i==0) {
-            data[i] = rand();
-        } else {
-            data[i] = ((data[i-1]+1) * i * 104723L) % N;
-        }
-    }
+// Element i of the vector, from a counter-based generator (splitmix64 on
+// seed + i), so any part of the vector can be generated independently and
+// the vector is the same whatever the number of threads
+unsigned long seed;
+
+static inline long element(long i) {
+    unsigned long x = seed + i + 0x9e3779b97f4a7c15UL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+    return (x ^ (x >> 31)) % N;
 }
 
-static void clear(long length, T data[length]) {
-    long i;
-    for (i = 0; i < length; i++) {
-        data[i] = 0;
+// Generate data, elements start .. start+length-1 of the vector, and clear
+// tmp. The vector is split in quarters with tasks down to the base cases of
+// multisort(), so the pages of both buffers are first touched by the threads
+// (and placed in the NUMA nodes) that sort each part of them.
+static void initialize(long length, T data[length], T tmp[length], long start) {
+    if (length >= MIN_SORT_SIZE*4L) {
+        for (int q = 0; q < 4; q++) {
+            #pragma omp task
+            initialize(length/4L, &data[q*length/4L], &tmp[q*length/4L], start + q*length/4L);
+        }
+        #pragma omp taskwait
+    } else {
+        for (long i = 0; i < length; i++) {
+            SET_KEY(data[i], element(start + i), start + i);
+            SET_KEY(tmp[i], 0, 0);
+        }
     }
 }
 
@@ -95,7 +104,7 @@ void check_sorted(long n, T data[n])
 {
     int unsorted=0;
     for (int i=1; i<n; i++)
-        if (data[i-1] > data[i]) unsorted++;
+        if (LESS(data[i], data[i-1])) unsorted++;
     if (unsorted > 0)
         printf ("\nERROR: data is NOT properly sorted. There are %d unordered positions\n\n",unsorted);
 }
@@ -149,14 +158,17 @@ int main(int argc, char **argv) {
 #endif
     fprintf(stdout, "*****************************************************************************************\n");
 
+    seed = rand();
+
     T *data = malloc(N*sizeof(T));
     T *tmp = malloc(N*sizeof(T));
 
     double stamp;
     START_COUNT_TIME;
 
-    initialize(N, data);
-    clear(N, tmp);
+    #pragma omp parallel
+    #pragma omp single
+    initialize(N, data, tmp, 0);
 
     STOP_COUNT_TIME("Initialization time in seconds");
 
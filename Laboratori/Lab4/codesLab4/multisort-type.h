@@ -0,0 +1,66 @@
+// Element type of the multisort programs, selected at compile time
+//
+//   default        T is int, sorted by value
+//   -DSORT_LONG    T is long (64-bit keys)
+//   -DSORT_PAIR    T is a (key, index) pair: a long key and the index of the
+//                  record it belongs to
+//
+// Other types are sorted by defining T, KEY(x) (the key of element x, of any
+// type ordered by <) and SET_KEY(x, key, index) before including this file.
+// Elements are compared by LESS(a, b), which is expanded inline by the
+// compiler: there are no calls through function pointers. It compares the
+// keys with < unless it is defined before including this file, for instance
+//   -D'LESS(a,b)=(KEY(a) > KEY(b))'
+// sorts in decreasing order. The programs and multisort-kernels.c have to be
+// compiled with the same definitions.
+//
+// SORT_INTEGER_KEY is defined when the keys are integers compared by < and
+// the data can also be sorted by radix sort.
+//
+// Records too large to be moved by the sort itself are sorted through an
+// index permutation: the (key, index) pairs of the records are sorted with
+// -DSORT_PAIR, so the recursion moves 16 bytes per element, and then the
+// records are moved once to their final position with record_permute().
+
+#include <string.h>
+
+typedef struct {
+    long key;
+    long index;
+} sort_pair;
+
+#ifndef T
+#define SORT_INTEGER_KEY
+#if defined(SORT_PAIR)
+#define T sort_pair
+#define KEY(x) ((x).key)
+#define SET_KEY(x, k, i) do { (x).key = (k); (x).index = (i); } while (0)
+#elif defined(SORT_LONG)
+#define T long
+#else
+#define T int
+#define SORT_INT
+#endif
+#endif
+
+#ifndef KEY
+#define KEY(x) (x)
+#endif
+#ifndef SET_KEY
+#define SET_KEY(x, k, i) ((x) = (k))
+#endif
+
+#ifndef LESS
+#define LESS(a, b) (KEY(a) < KEY(b))
+#else
+#undef SORT_INTEGER_KEY         // radix sort and the sorting network of
+#undef SORT_INT                 // multisort-kernels.c only know the order of <
+#endif
+
+// Store into out the n records of size bytes in records in the order given
+// by the sorted pairs, i.e. out[i] = records[pairs[i].index]
+static inline void record_permute(long n, size_t size, const void *records, void *out, const sort_pair pairs[n]) {
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < n; i++)
+        memcpy((char *) out + i*size, (const char *) records + pairs[i].index*size, size);
+}
@@ -0,0 +1,252 @@
+// Hybrid MPI+OpenMP Jacobi solver
+//
+// The grid is split in a 2D Cartesian grid of MPI processes. Each process
+// holds its block of interior points plus a halo of one point around it; the
+// halo is either the physical boundary of the grid or a copy of the border
+// points of the neighbour process, refreshed by solve() at every iteration.
+// Within a process the block is decomposed among the OpenMP threads in the
+// same way as in the shared memory solvers.
+//
+// The heat driver has to initialize MPI with at least MPI_THREAD_FUNNELED
+// (all MPI calls are done outside the parallel regions) and work on the
+// local blocks:
+//     mpi_decompose(MPI_COMM_WORLD, np, np, &lsizex, &lsizey);
+//     mpi_scatter(param.u, u);  mpi_scatter(param.uhelp, uhelp);
+//     ...
+//     residual = solve(u, uhelp, lsizex, lsizey);
+//     copy_mat(uhelp, u, lsizex, lsizey);
+//     ...
+//     mpi_gather(u, param.u);
+// where param.u and param.uhelp are the full grids, only needed (and only
+// read or written) in rank 0. The residual returned by solve() is the sum
+// of all processes, so the convergence test is the same in all of them.
+// Only Jacobi is supported: points next to the border of a block would
+// otherwise read points of the neighbours from the previous iteration.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "omp.h"
+
+#define lowerb(id, p, n)  ( id * (n/p) + (id < (n%p) ? id : n%p) )
+#define numElem(id, p, n) ( (n/p) + (id < (n%p)) )
+#define upperb(id, p, n)  ( lowerb(id, p, n) + numElem(id, p, n) - 1 )
+
+#define min(a, b) ( (a < b) ? a : b )
+#define max(a, b) ( (a > b) ? a : b )
+
+// Tags of the halo messages: direction in which they travel
+#define TAG_SOUTH 0
+#define TAG_NORTH 1
+#define TAG_EAST  2
+#define TAG_WEST  3
+
+static MPI_Comm cart = MPI_COMM_NULL;   // Cartesian communicator of the processes
+static int dims[2];                     // processes along x (rows) and y (columns)
+static int north, south, west, east;    // neighbours, MPI_PROC_NULL at the boundary
+static unsigned gsizex, gsizey;         // size of the full grid
+static unsigned bsizex, bsizey;         // size of the local block, halo included
+static MPI_Datatype column = MPI_DATATYPE_NULL;   // interior column of the local block
+
+// Rows (or columns) of the full grid in the block of the process at coord
+// of p, halo included: first one and number of them
+static void block_rows (int coord, int p, unsigned n, unsigned *first, unsigned *count) {
+  *first = lowerb(coord, p, (n-2));
+  *count = numElem(coord, p, (n-2)) + 2;
+}
+
+// Split the sizex x sizey grid among the processes of comm and return the
+// size of the local block of this process, halo included. Every process
+// needs at least one interior row and column: aborts if there are more
+// processes along a dimension than interior points.
+void mpi_decompose (MPI_Comm comm, unsigned sizex, unsigned sizey, unsigned *lsizex, unsigned *lsizey) {
+  int nprocs, coords[2], periods[2] = {0, 0};
+  unsigned first;
+
+  MPI_Comm_size(comm, &nprocs);
+  dims[0] = dims[1] = 0;
+  MPI_Dims_create(nprocs, 2, dims);
+  if (dims[0] > (int) sizex-2 || dims[1] > (int) sizey-2) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0)
+      fprintf(stderr, "Cannot split the %u x %u grid in %d x %d processes: at most %u x %u\n",
+              sizex, sizey, dims[0], dims[1], sizex-2, sizey-2);
+    MPI_Barrier(comm);                  // the message is written before any process aborts
+    MPI_Abort(comm, EXIT_FAILURE);
+  }
+  // A previous decomposition is replaced
+  if (cart != MPI_COMM_NULL) MPI_Comm_free(&cart);
+  if (column != MPI_DATATYPE_NULL) MPI_Type_free(&column);
+  MPI_Cart_create(comm, 2, dims, periods, 1, &cart);
+  MPI_Cart_shift(cart, 0, 1, &north, &south);
+  MPI_Cart_shift(cart, 1, 1, &west, &east);
+
+  int rank;
+  MPI_Comm_rank(cart, &rank);
+  MPI_Cart_coords(cart, rank, 2, coords);
+  gsizex = sizex;
+  gsizey = sizey;
+  block_rows(coords[0], dims[0], sizex, &first, &bsizex);
+  block_rows(coords[1], dims[1], sizey, &first, &bsizey);
+  *lsizex = bsizex;
+  *lsizey = bsizey;
+
+  MPI_Type_vector(bsizex-2, 1, bsizey, MPI_DOUBLE, &column);
+  MPI_Type_commit(&column);
+}
+
+// Type of the block of the process with rank in the full grid (halo
+// included if halo is set, only the interior points otherwise)
+static MPI_Datatype block_type (int rank, int halo) {
+  int coords[2], sizes[2] = {gsizex, gsizey}, subsizes[2], starts[2];
+  unsigned first, count;
+  MPI_Datatype type;
+
+  MPI_Cart_coords(cart, rank, 2, coords);
+  for (int d=0; d<2; d++) {
+    block_rows(coords[d], dims[d], sizes[d], &first, &count);
+    starts[d] = first + !halo;
+    subsizes[d] = count - 2*!halo;
+  }
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &type);
+  MPI_Type_commit(&type);
+  return type;
+}
+
+// Interior points of the local block (halo excluded) of lsizex x lsizey
+static MPI_Datatype local_type (unsigned lsizex, unsigned lsizey) {
+  int sizes[2] = {lsizex, lsizey}, subsizes[2] = {lsizex-2, lsizey-2}, starts[2] = {1, 1};
+  MPI_Datatype type;
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &type);
+  MPI_Type_commit(&type);
+  return type;
+}
+
+// Distribute the full grid of rank 0 into the local blocks, halo included
+void mpi_scatter (double *global, double *local) {
+  int rank, nprocs;
+  MPI_Comm_rank(cart, &rank);
+  MPI_Comm_size(cart, &nprocs);
+
+  if (rank == 0) {
+    MPI_Request *req = malloc(nprocs * sizeof(MPI_Request));
+    MPI_Datatype *type = malloc(nprocs * sizeof(MPI_Datatype));
+    for (int r=0; r<nprocs; r++) {
+      type[r] = block_type(r, 1);
+      MPI_Isend(global, 1, type[r], r, 0, cart, &req[r]);
+    }
+    MPI_Recv(local, bsizex*bsizey, MPI_DOUBLE, 0, 0, cart, MPI_STATUS_IGNORE);
+    MPI_Waitall(nprocs, req, MPI_STATUSES_IGNORE);
+    for (int r=0; r<nprocs; r++) MPI_Type_free(&type[r]);
+    free(type);
+    free(req);
+  }
+  else
+    MPI_Recv(local, bsizex*bsizey, MPI_DOUBLE, 0, 0, cart, MPI_STATUS_IGNORE);
+}
+
+// Collect the interior points of the local blocks into the full grid of rank 0
+void mpi_gather (double *local, double *global) {
+  int rank, nprocs;
+  MPI_Comm_rank(cart, &rank);
+  MPI_Comm_size(cart, &nprocs);
+  MPI_Datatype interior = local_type(bsizex, bsizey);
+  MPI_Request req;
+
+  MPI_Isend(local, 1, interior, 0, 0, cart, &req);
+  if (rank == 0) {
+    for (int r=0; r<nprocs; r++) {
+      MPI_Datatype type = block_type(r, 0);
+      MPI_Recv(global, 1, type, r, 0, cart, MPI_STATUS_IGNORE);
+      MPI_Type_free(&type);
+    }
+  }
+  MPI_Wait(&req, MPI_STATUS_IGNORE);
+  MPI_Type_free(&interior);
+}
+
+// Function to copy one matrix into another (interior points of the local block)
+void copy_mat (double *u, double *v, unsigned sizex, unsigned sizey) {
+  int nblocksi=omp_get_max_threads();
+  #pragma omp parallel
+  {
+    int blocki = omp_get_thread_num();
+    int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
+    for (int i=i_start; i<=i_end; i++)
+      memcpy(&v[i*sizey+1], &u[i*sizey+1], (sizey-2) * sizeof(double));
+  }
+}
+
+// Points i_start..i_end x j_start..j_end of unew from u, returns the sum of
+// the squared changes
+static inline double relax (double *u, double *unew, unsigned sizey,
+                            int i_start, int i_end, int j_start, int j_end) {
+  double sum=0.0;
+  for (int i=i_start; i<=i_end; i++)
+    for (int j=j_start; j<=j_end; j++) {
+      double tmp = 0.25 * ( u[ i*sizey     + (j-1) ] +  // left
+                            u[ i*sizey     + (j+1) ] +  // right
+                            u[ (i-1)*sizey + j     ] +  // top
+                            u[ (i+1)*sizey + j     ] ); // bottom
+      double diff = tmp - u[i*sizey + j];
+      sum += diff * diff;
+      unew[i*sizey + j] = tmp;
+    }
+  return sum;
+}
+
+// 2D-blocked solver on the local block: one iteration step. The halo of u
+// is exchanged while the points that do not need it are computed, and the
+// border of the block is computed once it has arrived.
+double solve (double *u, double *unew, unsigned sizex, unsigned sizey) {
+  double sum=0.0;
+  int nblocksi=omp_get_max_threads();
+  int nblocksj=1;
+  MPI_Request req[8];
+
+  MPI_Irecv(&u[1],                   sizey-2, MPI_DOUBLE, north, TAG_SOUTH, cart, &req[0]);
+  MPI_Irecv(&u[(sizex-1)*sizey + 1], sizey-2, MPI_DOUBLE, south, TAG_NORTH, cart, &req[1]);
+  MPI_Irecv(&u[sizey],               1,       column,     west,  TAG_EAST,  cart, &req[2]);
+  MPI_Irecv(&u[2*sizey - 1],         1,       column,     east,  TAG_WEST,  cart, &req[3]);
+  MPI_Isend(&u[sizey + 1],           sizey-2, MPI_DOUBLE, north, TAG_NORTH, cart, &req[4]);
+  MPI_Isend(&u[(sizex-2)*sizey + 1], sizey-2, MPI_DOUBLE, south, TAG_SOUTH, cart, &req[5]);
+  MPI_Isend(&u[sizey + 1],           1,       column,     west,  TAG_WEST,  cart, &req[6]);
+  MPI_Isend(&u[2*sizey - 2],         1,       column,     east,  TAG_EAST,  cart, &req[7]);
+
+  // Points whose neighbours are all in the block
+  #pragma omp parallel reduction(+:sum)
+  {
+    int blocki = omp_get_thread_num();
+    int i_start = max(2, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-3, upperb(blocki, nblocksi, sizex));
+    for (int blockj=0; blockj<nblocksj; ++blockj) {
+      int j_start = max(2, lowerb(blockj, nblocksj, sizey));
+      int j_end = min(sizey-3, upperb(blockj, nblocksj, sizey));
+      sum += relax(u, unew, sizey, i_start, i_end, j_start, j_end);
+    }
+  }
+
+  MPI_Waitall(8, req, MPI_STATUSES_IGNORE);
+
+  // Border of the block: first and last rows, first and last columns
+  #pragma omp parallel reduction(+:sum)
+  {
+    int blocki = omp_get_thread_num();
+    int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
+    for (int i=i_start; i<=i_end; i++) {
+      if (i == 1 || i == sizex-2)
+        sum += relax(u, unew, sizey, i, i, 1, sizey-2);
+      else {
+        sum += relax(u, unew, sizey, i, i, 1, 1);
+        if (sizey-2 > 1) sum += relax(u, unew, sizey, i, i, sizey-2, sizey-2);
+      }
+    }
+  }
+
+  MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, cart);
+  return sum;
+}
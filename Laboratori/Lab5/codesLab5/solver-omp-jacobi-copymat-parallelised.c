@@ -1,4 +1,10 @@
+#include <stdlib.h>
+#include <string.h>
 #include "omp.h"
+#include "../../common/par-instrument.h"
+#if defined(STREAM_STORES) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define lowerb(id, p, n)  ( id * (n/p) + (id < (n%p) ? id : n%p) )
 #define numElem(id, p, n) ( (n/p) + (id < (n%p)) )
@@ -13,8 +19,10 @@ extern int userparam;
 void copy_mat (double *u, double *v, unsigned sizex, unsigned sizey) {
   int nblocksi=omp_get_max_threads();
   int nblocksj=1;
+  PAR_PHASE_BEGIN("copy_mat");
   #pragma omp parallel 
   {
+      PAR_WORK_BEGIN;
  			int blocki = omp_get_thread_num();
       int i_start = lowerb(blocki, nblocksi, sizex); //las dependencias son: blocki==i, nblocksi==8, sizex
       int i_end = upperb(blocki, nblocksi, sizex); //las dependencias son:
@@ -25,35 +33,339 @@ void copy_mat (double *u, double *v, unsigned sizex, unsigned sizey) {
           for (int j=max(1, j_start); j<=min(sizey-2, j_end); j++)
             v[i*sizey+j] = u[i*sizey+j];
       }
+      PAR_WORK_END;
   }
+  PAR_PHASE_END;
+}
+
+// Stencil kernel: points i_start..i_end x j_start..j_end of unew from u,
+// returns the sum of the squared changes. u and unew never overlap in the
+// Jacobi solvers of this file, so they are restrict and the loop over j is
+// vectorized, with row pointers computed once per row and one partial sum
+// per vector lane. With -DSTREAM_STORES unew is written with non-temporal
+// stores, which do not read the lines of unew into the cache first (useful
+// when the grid is much larger than the caches).
+static inline double stencil (const double *restrict u, double *restrict unew, unsigned sizey,
+                              int i_start, int i_end, int j_start, int j_end) {
+  double sum=0.0;
+  for (int i=i_start; i<=i_end; i++) {
+    const double *restrict row = &u[i*sizey];
+    const double *restrict top = row - sizey;
+    const double *restrict bottom = row + sizey;
+    double *restrict out = &unew[i*sizey];
+    int j = j_start;
+#if defined(STREAM_STORES) && defined(__SSE2__)
+    if (j <= j_end && ((size_t) &out[j] % 16) != 0) {
+      double tmp = 0.25 * ( row[j-1] + row[j+1] + top[j] + bottom[j] );
+      double diff = tmp - row[j];
+      sum += diff * diff;
+      out[j++] = tmp;
+    }
+    __m128d quarter = _mm_set1_pd(0.25), vsum = _mm_setzero_pd();
+    for (; j+1<=j_end; j+=2) {
+      __m128d c = _mm_loadu_pd(&row[j]);
+      __m128d tmp = _mm_mul_pd(quarter, _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_loadu_pd(&row[j-1]), _mm_loadu_pd(&row[j+1])),
+                                                              _mm_loadu_pd(&top[j])), _mm_loadu_pd(&bottom[j])));
+      __m128d diff = _mm_sub_pd(tmp, c);
+      vsum = _mm_add_pd(vsum, _mm_mul_pd(diff, diff));
+      _mm_stream_pd(&out[j], tmp);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, vsum);
+    sum += lanes[0] + lanes[1];
+#else
+    #pragma omp simd reduction(+:sum)
+    for (j=j_start; j<=j_end; j++) {
+      double tmp = 0.25 * ( row[j-1] +      // left
+                            row[j+1] +      // right
+                            top[j] +        // top
+                            bottom[j] );    // bottom
+      double diff = tmp - row[j];
+      sum += diff * diff;
+      out[j] = tmp;
+    }
+    j = j_end+1;
+#endif
+    for (; j<=j_end; j++) {
+      double tmp = 0.25 * ( row[j-1] + row[j+1] + top[j] + bottom[j] );
+      double diff = tmp - row[j];
+      sum += diff * diff;
+      out[j] = tmp;
+    }
+  }
+#if defined(STREAM_STORES) && defined(__SSE2__)
+  _mm_sfence();
+#endif
+  return sum;
 }
 
 // 2D-blocked solver: one iteration step
 double solve (double *u, double *unew, unsigned sizex, unsigned sizey) {
-  double tmp, diff, sum=0.0;
+  double sum=0.0;
   int nblocksi=omp_get_max_threads();
   int nblocksj=1;
   
-  #pragma omp parallel private(diff) reduction(+:sum) //complete data sharing constructs here
+  PAR_PHASE_BEGIN("solve");
+  #pragma omp parallel reduction(+:sum) //complete data sharing constructs here
   {
+    PAR_WORK_BEGIN;
     int blocki = omp_get_thread_num();
-    int i_start = lowerb(blocki, nblocksi, sizex);
-    int i_end = upperb(blocki, nblocksi, sizex);
+    int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
     for (int blockj=0; blockj<nblocksj; ++blockj) {
-      int j_start = lowerb(blockj, nblocksj, sizey);
-      int j_end = upperb(blockj, nblocksj, sizey);
-      for (int i=max(1, i_start); i<=min(sizex-2, i_end); i++) {
-        for (int j=max(1, j_start); j<=min(sizey-2, j_end); j++) {
-        tmp = 0.25 * ( u[ i*sizey	   + (j-1) ] +  // left
-                         u[ i*sizey	   + (j+1) ] +  // right
-                         u[ (i-1)*sizey + j     ] +  // top
-                         u[ (i+1)*sizey + j     ] ); // bottom
-        diff = tmp - u[i*sizey+ j];
-        sum += diff * diff;
-        unew[i*sizey+j] = tmp;
+      int j_start = max(1, lowerb(blockj, nblocksj, sizey));
+      int j_end = min(sizey-2, upperb(blockj, nblocksj, sizey));
+      sum += stencil(u, unew, sizey, i_start, i_end, j_start, j_end);
+    }
+    PAR_WORK_END;
+  }
+  PAR_PHASE_END;
+  return sum;
+}
+
+// Copy the boundary (first and last rows and columns) of u into v
+void copy_boundary (double *u, double *v, unsigned sizex, unsigned sizey) {
+  memcpy(&v[0], &u[0], sizey * sizeof(double));
+  memcpy(&v[(sizex-1)*sizey], &u[(sizex-1)*sizey], sizey * sizeof(double));
+  for (int i=1; i<sizex-1; i++) {
+    v[i*sizey] = u[i*sizey];
+    v[i*sizey + sizey-1] = u[i*sizey + sizey-1];
+  }
+}
+
+// Double-buffered solver: one iteration step from *u into *unew, and then
+// the two buffers swap roles, so *u always holds the last iterate and the
+// copy_mat() after every step is not needed. The boundary is never written,
+// so both buffers have to start with the same one:
+//     copy_boundary(param.u, param.uhelp, np, np);     // once
+//     residual = solve_swap(&param.u, &param.uhelp, np, np);
+// The residual is the same as the one of solve().
+double solve_swap (double **u, double **unew, unsigned sizex, unsigned sizey) {
+  double sum = solve(*u, *unew, sizex, sizey);
+  double *t = *u;
+  *u = *unew;
+  *unew = t;
+  return sum;
+}
+
+#define PAD 8                   // doubles per cache line, partial sums are padded to whole lines
+
+// Iteration engine: Jacobi iterations with pointer swap (as solve_swap())
+// until the residual is below tolerance or maxiter iterations are done
+// (maxiter 0 means no limit), the same stop conditions as the heat driver.
+// A single parallel region runs all the iterations: every thread computes
+// the bounds of its block of rows once, and after each step writes its
+// partial sum to its own cache line and waits in one barrier. Then every
+// thread adds the partial sums in the same order, so all of them get the
+// same residual and take the same decision without another barrier. The
+// partial sums alternate between two sets, so a thread can write the next
+// ones while others are still reading the previous ones. On return *u holds
+// the last iterate and *residual the last residual. Returns the number of
+// iterations.
+int solve_iterations (double **u, double **unew, unsigned sizex, unsigned sizey,
+                      int maxiter, double tolerance, double *residual) {
+  int nthreads = omp_get_max_threads();
+  double *partial = aligned_alloc(64, 2 * nthreads * PAD * sizeof(double));
+  int iter = 0;
+
+  copy_boundary(*u, *unew, sizex, sizey);
+
+  #pragma omp parallel num_threads(nthreads)
+  {
+    int blocki = omp_get_thread_num();
+    int nblocksi = omp_get_num_threads();
+    int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
+    double *src = *u, *dst = *unew;
+    int k = 0;
+    double sum;
+
+    for (;;) {
+      double local = stencil(src, dst, sizey, i_start, i_end, 1, sizey-2);
+      double *sums = &partial[(k % 2) * nblocksi * PAD];
+      sums[blocki * PAD] = local;
+      #pragma omp barrier
+
+      sum = 0.0;
+      for (int t=0; t<nblocksi; t++) sum += sums[t * PAD];
+      double *t = src; src = dst; dst = t;
+      k++;
+      if (sum < tolerance || (maxiter > 0 && k >= maxiter)) break;
+    }
+
+    #pragma omp master
+    {
+      *u = src;
+      *unew = dst;
+      *residual = sum;
+      iter = k;
+    }
+  }
+
+  free(partial);
+  return iter;
+}
+
+// Temporal blocking: nsteps tiles on each side of the tile are copied once and reused for all the steps
+#define TILE_I 64
+#define TILE_J 128
+
+// Temporally blocked solver: nsteps iteration steps at once, same result in
+// unew as nsteps calls to solve() each followed by copy_mat(unew, u). The
+// grid is split in TILE_I x TILE_J tiles, and every tile is computed with
+// its halo of nsteps points (overlapped tiling): the tile and halo are copied
+// into two private buffers that stay in cache while the steps alternate
+// between them, each step computing one point less on every side. Only u is
+// read and only the points of the tile are written to unew, so tiles are
+// independent. Returns the residual of the last step, so the heat driver can
+// check convergence every nsteps iterations:
+//     residual = solve_steps(param.u, param.uhelp, np, np, nsteps);
+//     copy_mat(param.uhelp, param.u, np, np);
+//     iter += nsteps;
+double solve_steps (double *u, double *unew, unsigned sizex, unsigned sizey, int nsteps) {
+  double sum=0.0;
+  int tilesi = (sizex - 2 + TILE_I - 1) / TILE_I;
+  int tilesj = (sizey - 2 + TILE_J - 1) / TILE_J;
+  int bufsize = (TILE_I + 2*nsteps) * (TILE_J + 2*nsteps);
+
+  #pragma omp parallel reduction(+:sum)
+  {
+    double *a = malloc(bufsize * sizeof(double));
+    double *b = malloc(bufsize * sizeof(double));
+
+    #pragma omp for collapse(2) schedule(dynamic)
+    for (int ti=0; ti<tilesi; ++ti) {
+      for (int tj=0; tj<tilesj; ++tj) {
+        // Points of the tile and of the tile with its halo
+        int i_start = 1 + ti*TILE_I, i_end = min((int) sizex-2, i_start + TILE_I - 1);
+        int j_start = 1 + tj*TILE_J, j_end = min((int) sizey-2, j_start + TILE_J - 1);
+        int hi_start = max(0, i_start - nsteps), hi_end = min((int) sizex-1, i_end + nsteps);
+        int hj_start = max(0, j_start - nsteps), hj_end = min((int) sizey-1, j_end + nsteps);
+        int width = hj_end - hj_start + 1;
+
+        for (int i=hi_start; i<=hi_end; i++) {
+          memcpy(&a[(i-hi_start)*width], &u[i*sizey + hj_start], width * sizeof(double));
+          memcpy(&b[(i-hi_start)*width], &u[i*sizey + hj_start], width * sizeof(double));
         }
+
+        double *src = a, *dst = b;
+        for (int s=1; s<=nsteps; s++) {
+          int last = (s == nsteps);
+          for (int i=max(1, i_start-nsteps+s); i<=min((int) sizex-2, i_end+nsteps-s); i++) {
+            double *row = &src[(i-hi_start)*width - hj_start];
+            double *out = &dst[(i-hi_start)*width - hj_start];
+            for (int j=max(1, j_start-nsteps+s); j<=min((int) sizey-2, j_end+nsteps-s); j++) {
+              double tmp = 0.25 * ( row[ j-1 ] +      // left
+                                    row[ j+1 ] +      // right
+                                    row[ j-width ] +  // top
+                                    row[ j+width ] ); // bottom
+              if (last) {
+                double diff = tmp - row[j];
+                sum += diff * diff;
+              }
+              out[j] = tmp;
+            }
+          }
+          double *t = src; src = dst; dst = t;
+        }
+
+        for (int i=i_start; i<=i_end; i++)
+          memcpy(&unew[i*sizey + j_start], &src[(i-hi_start)*width + (j_start-hj_start)], (j_end-j_start+1) * sizeof(double));
+      }
+    }
+    free(a);
+    free(b);
+  }
+  return sum;
+}
+
+// Mixed precision: grids stored in float, residual accumulated in double.
+// Each step moves half the bytes of solve() + copy_mat().
+void copy_mat_float (float *u, float *v, unsigned sizex, unsigned sizey) {
+  int nblocksi=omp_get_max_threads();
+  #pragma omp parallel
+  {
+    int blocki = omp_get_thread_num();
+    int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
+    for (int i=i_start; i<=i_end; i++)
+      memcpy(&v[i*sizey+1], &u[i*sizey+1], (sizey-2) * sizeof(float));
+  }
+}
+
+// One iteration step as solve() on float grids
+double solve_float (float *u, float *unew, unsigned sizex, unsigned sizey) {
+  double sum=0.0;
+  int nblocksi=omp_get_max_threads();
+
+  #pragma omp parallel reduction(+:sum)
+  {
+    int blocki = omp_get_thread_num();
+    int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
+    for (int i=i_start; i<=i_end; i++) {
+      const float *restrict row = &u[i*sizey];
+      const float *restrict top = row - sizey;
+      const float *restrict bottom = row + sizey;
+      float *restrict out = &unew[i*sizey];
+      #pragma omp simd reduction(+:sum)
+      for (int j=1; j<=sizey-2; j++) {
+        float tmp = 0.25f * ( row[j-1] + row[j+1] + top[j] + bottom[j] );
+        double diff = (double) tmp - row[j];
+        sum += diff * diff;
+        out[j] = tmp;
       }
     }
   }
   return sum;
-}
\ No newline at end of file
+}
+
+#define MIXED_SWITCH 2          // float steps until the residual is below MIXED_SWITCH * tolerance
+#define MIXED_STALL 50          // ... or has not decreased for MIXED_STALL steps
+
+// Iteration engine in mixed precision, same arguments and stop conditions as
+// solve_iterations(). The iterations start on float copies of the grids;
+// once the residual gets close to tolerance (or stops decreasing because
+// float has no more digits to give) the float iterate is copied back to u
+// and the last iterations, which decide convergence, are done in double
+// with solve(), at least one of them. On return u holds the last iterate (the buffers are not
+// swapped), so the heat driver just replaces its loop with
+//     iter = solve_mixed(param.u, param.uhelp, np, np, param.maxiter, 0.00005, &residual);
+int solve_mixed (double *u, double *unew, unsigned sizex, unsigned sizey,
+                 int maxiter, double tolerance, double *residual) {
+  float *uf = malloc(sizex * sizey * sizeof(float));
+  float *ufnew = malloc(sizex * sizey * sizeof(float));
+  double sum = 0.0, best = 0.0;
+  int iter = 0, stall = 0;
+
+  #pragma omp parallel for
+  for (int i=0; i<sizex*sizey; i++) uf[i] = ufnew[i] = u[i];
+
+  // The last of the maxiter steps is left for double
+  while (maxiter == 0 || iter < maxiter - 1) {
+    sum = solve_float(uf, ufnew, sizex, sizey);
+    copy_mat_float(ufnew, uf, sizex, sizey);
+    iter++;
+    if (iter == 1 || sum < best) { best = sum; stall = 0; }
+    else stall++;
+    if (sum < MIXED_SWITCH * tolerance || stall >= MIXED_STALL) break;
+  }
+
+  // Only the interior: the boundary of u keeps its double values
+  #pragma omp parallel for
+  for (int i=1; i<sizex-1; i++)
+    for (int j=1; j<sizey-1; j++) u[i*sizey + j] = uf[i*sizey + j];
+  free(uf);
+  free(ufnew);
+
+  // At least one step in double, so the residual returned is never the one
+  // of a float step
+  do {
+    sum = solve(u, unew, sizex, sizey);
+    copy_mat(unew, u, sizex, sizey);
+    iter++;
+  } while (sum >= tolerance && (maxiter == 0 || iter < maxiter));
+
+  *residual = sum;
+  return iter;
+}
@@ -0,0 +1,254 @@
+// Geometric multigrid on top of solve()
+//
+// Compile together with one of the Jacobi solvers (for instance
+// solver-omp-jacobi-copymat-parallelised.c), whose solve() smooths the
+// finest grid. The heat problem has no source, so the finest grid solves
+// A u = 0 and solve() can be used as is; the coarser grids solve the
+// equations of the error, A e = r, and are smoothed by smooth_rhs() here.
+// The smoother is weighted Jacobi with weight 4/5 (plain Jacobi does not
+// damp the highest frequencies). The residual is restricted with full
+// weighting and the correction is prolongated by bilinear interpolation.
+// Grids of any size are coarsened: a grid with m interior points per side
+// has mc = (m-1)/2 coarse interior points, evenly spaced between the same
+// boundaries, so the spacing grows by (m+1)/(mc+1). When m is odd this is
+// 2 and the coarse points are the even points of the fine grid; otherwise
+// the interpolation and its transpose, the restriction, weight the fine
+// points by their distance to the coarse ones.
+//
+// One call is one cycle, so it can replace solve() + copy_mat() in the heat
+// driver:
+//     residual = solve_multigrid(param.u, param.uhelp, np, np, levels, cycle);
+// where cycle is 1 for V-cycles and 2 for W-cycles. The return value is the
+// residual of the last call to solve(), so the usual convergence test of the
+// driver still applies, and it is reached in a number of cycles that does
+// not depend on the size of the grid.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "omp.h"
+
+#define lowerb(id, p, n)  ( id * (n/p) + (id < (n%p) ? id : n%p) )
+#define numElem(id, p, n) ( (n/p) + (id < (n%p)) )
+#define upperb(id, p, n)  ( lowerb(id, p, n) + numElem(id, p, n) - 1 )
+
+#define min(a, b) ( (a < b) ? a : b )
+#define max(a, b) ( (a > b) ? a : b )
+
+#define MG_LEVELS 16            // maximum number of levels
+#define MG_PRE 2                // smoothing steps before the coarse grid correction
+#define MG_POST 2               // smoothing steps after it
+#define MG_COARSEST 50          // smoothing steps that solve the coarsest grid
+#define MG_WEIGHT 0.8           // weight of the Jacobi smoother
+
+void copy_mat (double *u, double *v, unsigned sizex, unsigned sizey);
+double solve (double *u, double *unew, unsigned sizex, unsigned sizey);
+
+// Grid of a level: sizex x sizey points including the boundary, with the
+// error e (and a second buffer for the smoother), the right hand side b and
+// the residual r. Boundary points are always 0. rx and ry are the spacing
+// of the grid over the one of the finer level.
+typedef struct {
+  unsigned sizex, sizey;
+  double rx, ry;
+  double *e, *enew, *b, *r;
+} level_t;
+
+static level_t level[MG_LEVELS];
+static int nlevels = 0;         // levels allocated
+static int mg_requested = 0;    // levels asked for when they were allocated
+static int mg_levels;           // levels of the current cycle
+
+// Grids of the levels below the finest one of sizex x sizey points, reused
+// between calls while the size does not change. Returns the number of levels,
+// fewer than requested if the grid cannot be coarsened that many times.
+static int mg_setup (unsigned sizex, unsigned sizey, int levels) {
+  // The grids are enough if there are as many as requested, or if the last
+  // setup already got all the ones the size allows
+  if (nlevels > 0 && level[0].sizex == sizex && level[0].sizey == sizey &&
+      (levels <= nlevels || nlevels < mg_requested)) return min(levels, nlevels);
+
+  for (int l=1; l<nlevels; l++) {
+    free(level[l].e); free(level[l].enew); free(level[l].b); free(level[l].r);
+  }
+  free(level[0].r);
+  level[0].sizex = sizex;
+  level[0].sizey = sizey;
+  level[0].r = calloc(sizex*sizey, sizeof(double));
+
+  int l;
+  for (l=1; l<levels && l<MG_LEVELS; l++) {
+    unsigned mx = (level[l-1].sizex - 2 - 1) / 2, my = (level[l-1].sizey - 2 - 1) / 2;
+    if (mx < 1 || my < 1) break;
+    level[l].sizex = mx + 2;
+    level[l].sizey = my + 2;
+    level[l].rx = (double) (level[l-1].sizex - 1) / (mx + 1);
+    level[l].ry = (double) (level[l-1].sizey - 1) / (my + 1);
+    level[l].e = calloc(level[l].sizex*level[l].sizey, sizeof(double));
+    level[l].enew = calloc(level[l].sizex*level[l].sizey, sizeof(double));
+    level[l].b = calloc(level[l].sizex*level[l].sizey, sizeof(double));
+    level[l].r = calloc(level[l].sizex*level[l].sizey, sizeof(double));
+  }
+  nlevels = l;
+  mg_requested = levels;
+  return l;
+}
+
+// Weighted Jacobi steps for 4e - (sum of the neighbours of e) = b
+static void smooth_rhs (level_t *g, int steps) {
+  unsigned sizex = g->sizex, sizey = g->sizey;
+  for (int s=0; s<steps; s++) {
+    double *e = g->e, *enew = g->enew, *b = g->b;
+    #pragma omp parallel
+    {
+      int nblocksi = omp_get_num_threads();
+      int blocki = omp_get_thread_num();
+      int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+      int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
+      for (int i=i_start; i<=i_end; i++)
+        for (int j=1; j<=sizey-2; j++) {
+          double tmp = 0.25 * ( e[i*sizey + (j-1)] + e[i*sizey + (j+1)] +
+                                e[(i-1)*sizey + j] + e[(i+1)*sizey + j] + b[i*sizey + j] );
+          enew[i*sizey + j] = e[i*sizey + j] + MG_WEIGHT * (tmp - e[i*sizey + j]);
+        }
+    }
+    g->e = enew;
+    g->enew = e;
+  }
+}
+
+// r = b - (4e - sum of the neighbours of e), with b = 0 if it is NULL
+static void residual (double *e, double *b, double *r, unsigned sizex, unsigned sizey) {
+  #pragma omp parallel
+  {
+    int nblocksi = omp_get_num_threads();
+    int blocki = omp_get_thread_num();
+    int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
+    for (int i=i_start; i<=i_end; i++)
+      for (int j=1; j<=sizey-2; j++)
+        r[i*sizey + j] = (b ? b[i*sizey + j] : 0.0) - 4*e[i*sizey + j]
+                       + e[i*sizey + (j-1)] + e[i*sizey + (j+1)] + e[(i-1)*sizey + j] + e[(i+1)*sizey + j];
+  }
+}
+
+// Fine points around coarse point c for spacing ratio r (from *first on,
+// returns how many) and their weights in the interpolation of c: 1 at c,
+// 0 at the neighbours of c
+static inline int hat (int c, double r, int n, int *first, double *w) {
+  double x = c * r;
+  int lo = max(0, (int) floor(x - r) + 1), hi = min(n-1, (int) ceil(x + r) - 1);
+  for (int i=lo; i<=hi; i++) w[i-lo] = 1.0 - fabs(i - x) / r;
+  *first = lo;
+  return hi - lo + 1;
+}
+
+// Right hand side of the coarse grid from the residual r of the fine grid:
+// weighted average of the fine points around every coarse point (full
+// weighting for a ratio of 2), scaled by (H/h)^2. The error of the coarse
+// grid starts at 0.
+static void restrict_residual (level_t *fine, level_t *coarse) {
+  unsigned sizex = coarse->sizex, sizey = coarse->sizey;
+  int fx = fine->sizex, fy = fine->sizey;
+  double rx = coarse->rx, ry = coarse->ry;
+  double *r = fine->r, *b = coarse->b, *e = coarse->e;
+  #pragma omp parallel
+  {
+    int nblocksi = omp_get_num_threads();
+    int blocki = omp_get_thread_num();
+    int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
+    double wi[8], wj[8];
+    for (int i=i_start; i<=i_end; i++) {
+      int fi, ni = hat(i, rx, fx, &fi, wi);
+      double si = 0.0;
+      for (int a=0; a<ni; a++) si += wi[a];
+      for (int j=1; j<=sizey-2; j++) {
+        int fj, nj = hat(j, ry, fy, &fj, wj);
+        double sj = 0.0, sum = 0.0;
+        for (int c=0; c<nj; c++) sj += wj[c];
+        for (int a=0; a<ni; a++) {
+          double row = 0.0;
+          for (int c=0; c<nj; c++) row += wj[c] * r[(fi+a)*fy + fj+c];
+          sum += wi[a] * row;
+        }
+        b[i*sizey + j] = rx * ry * sum / (si * sj);
+        e[i*sizey + j] = 0.0;
+      }
+    }
+  }
+}
+
+// u += bilinear interpolation of the error of the coarse grid
+static void prolongate (level_t *coarse, double *u, unsigned sizex, unsigned sizey) {
+  unsigned cy = coarse->sizey;
+  double *e = coarse->e;
+  #pragma omp parallel
+  {
+    int nblocksi = omp_get_num_threads();
+    int blocki = omp_get_thread_num();
+    int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
+    for (int i=i_start; i<=i_end; i++) {
+      double x = i / coarse->rx;
+      int i0 = (int) x;
+      double wi = x - i0;
+      for (int j=1; j<=sizey-2; j++) {
+        double y = j / coarse->ry;
+        int j0 = (int) y;
+        double wj = y - j0;
+        double *c = &e[i0*cy + j0];
+        u[i*sizey + j] += (1-wi) * ((1-wj) * c[0]  + wj * c[1])
+                        +    wi  * ((1-wj) * c[cy] + wj * c[cy+1]);
+      }
+    }
+  }
+}
+
+// Weighted Jacobi step of the finest grid with solve(), returns its residual
+static double smooth_fine (double *u, double *unew, unsigned sizex, unsigned sizey) {
+  double sum = solve(u, unew, sizex, sizey);
+  #pragma omp parallel
+  {
+    int nblocksi = omp_get_num_threads();
+    int blocki = omp_get_thread_num();
+    int i_start = max(1, lowerb(blocki, nblocksi, sizex));
+    int i_end = min(sizex-2, upperb(blocki, nblocksi, sizex));
+    for (int i=i_start; i<=i_end; i++)
+      for (int j=1; j<=sizey-2; j++)
+        u[i*sizey + j] += MG_WEIGHT * (unew[i*sizey + j] - u[i*sizey + j]);
+  }
+  return sum;
+}
+
+// Cycle for the error equation of level l
+static void mg_cycle (int l, int cycle) {
+  level_t *g = &level[l];
+  if (l == mg_levels-1) {
+    smooth_rhs(g, MG_COARSEST);
+    return;
+  }
+  smooth_rhs(g, MG_PRE);
+  residual(g->e, g->b, g->r, g->sizex, g->sizey);
+  restrict_residual(g, &level[l+1]);
+  for (int c=0; c<cycle; c++) mg_cycle(l+1, cycle);
+  prolongate(&level[l+1], g->e, g->sizex, g->sizey);
+  smooth_rhs(g, MG_POST);
+}
+
+// One multigrid cycle (1 V-cycle, 2 W-cycle) with up to levels grids on u,
+// unew is used by solve(). Returns the residual of the last smoothing step.
+double solve_multigrid (double *u, double *unew, unsigned sizex, unsigned sizey, int levels, int cycle) {
+  double sum = 0.0;
+  levels = mg_levels = mg_setup(sizex, sizey, max(1, levels));
+
+  for (int s=0; s<MG_PRE; s++) sum = smooth_fine(u, unew, sizex, sizey);
+  if (levels > 1) {
+    residual(u, NULL, level[0].r, sizex, sizey);
+    restrict_residual(&level[0], &level[1]);
+    for (int c=0; c<max(1, cycle); c++) mg_cycle(1, max(1, cycle));
+    prolongate(&level[1], u, sizex, sizey);
+  }
+  for (int s=0; s<MG_POST; s++) sum = smooth_fine(u, unew, sizex, sizey);
+  return sum;
+}
@@ -1,5 +1,6 @@
 // OPTIONAL 2 - Gauss-Seidel
 
+#include <stdlib.h>
 #include "omp.h"
 
 #define lowerb(id, p, n)  ( id * (n/p) + (id < (n%p) ? id : n%p) )
@@ -30,46 +31,54 @@ void copy_mat (double *u, double *v, unsigned sizex, unsigned sizey) {
   }
 }
 
-// 2D-blocked solver: one iteration step
+// 2D-blocked solver: one iteration step, one task per block of
+// nblocksi x nblocksj blocks (userparam blocks of columns per block of rows).
+// In the Gauss-Seidel case (u == unew) each block depends on the block above
+// and on the block to its left, through the elements of dep, so the blocks
+// run as a wavefront; in the Jacobi case they only depend on themselves. Every block
+// leaves its part of the residual in partial, added in order at the end.
 double solve (double *u, double *unew, unsigned sizex, unsigned sizey) {
-  double tmp, diff, sum=0.0;
+  double sum=0.0;
   int nblocksi=omp_get_max_threads();
-  int nblocksj=nblocksi;
-  int mat[24] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
-  
+  int nblocksj=nblocksi * max(1, userparam);
+  char *dep = calloc((nblocksi+1) * (nblocksj+1), sizeof(char));
+  double *partial = calloc(nblocksi * nblocksj, sizeof(double));
+
   #pragma omp parallel
   #pragma omp single
   {
-    int cont;
-    int blocki = omp_get_thread_num();
-    int i_start = lowerb(blocki, nblocksi, sizex);
-    int i_end = upperb(blocki, nblocksi, sizex);
-    #pragma omp taskloop
-    for (int blockj=0; blockj<nblocksj; ++blockj) {
-      int j_start = lowerb(blockj, nblocksj, sizey);
-      int j_end = upperb(blockj, nblocksj, sizey);
-      if ((u == unew) && blocki != 0) {
-        do {
-          #pragma omp atomic read
-          cont = mat[blocki-1];
-        } while (cont <= blockj);
-      }
-      for (int i=max(1, i_start); i<=min(sizex-2, i_end); i++) {
-        for (int j=max(1, j_start); j<=min(sizey-2, j_end); j++) {
-          tmp = 0.25 * ( u[ i*sizey	   + (j-1) ] +  // left
-                           u[ i*sizey	   + (j+1) ] +  // right
-                           u[ (i-1)*sizey + j     ] +  // top
-                           u[ (i+1)*sizey + j     ] ); // bottom
-          diff = tmp - u[i*sizey+ j];
-          sum += diff * diff;
-          unew[i*sizey+j] = tmp;
+    for (int blocki=0; blocki<nblocksi; ++blocki) {
+      for (int blockj=0; blockj<nblocksj; ++blockj) {
+        char *above = &dep[blocki*(nblocksj+1) + blockj+1];
+        char *left = &dep[(blocki+1)*(nblocksj+1) + blockj];
+        char *self = &dep[(blocki+1)*(nblocksj+1) + blockj+1];
+        if (u != unew) above = left = self;
+        #pragma omp task depend(in: above[0], left[0]) depend(out: self[0])
+        {
+          int i_start = lowerb(blocki, nblocksi, sizex);
+          int i_end = upperb(blocki, nblocksi, sizex);
+          int j_start = lowerb(blockj, nblocksj, sizey);
+          int j_end = upperb(blockj, nblocksj, sizey);
+          double tmp, diff, local = 0.0;
+          for (int i=max(1, i_start); i<=min(sizex-2, i_end); i++) {
+            for (int j=max(1, j_start); j<=min(sizey-2, j_end); j++) {
+              tmp = 0.25 * ( u[ i*sizey	   + (j-1) ] +  // left
+                               u[ i*sizey	   + (j+1) ] +  // right
+                               u[ (i-1)*sizey + j     ] +  // top
+                               u[ (i+1)*sizey + j     ] ); // bottom
+              diff = tmp - u[i*sizey+ j];
+              local += diff * diff;
+              unew[i*sizey+j] = tmp;
+            }
+          }
+          partial[blocki*nblocksj + blockj] = local;
         }
       }
-      if (u == unew) {
-        #pragma omp atomic write
-        mat[blocki] = mat[blocki] + 1;
-      }
     }
   }
+
+  for (int b=0; b<nblocksi*nblocksj; b++) sum += partial[b];
+  free(dep);
+  free(partial);
   return sum;
-}
\ No newline at end of file
+}
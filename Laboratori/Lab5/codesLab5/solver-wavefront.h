@@ -0,0 +1,73 @@
+/*
+ * Pipelined wavefront step of the Gauss-Seidel solvers
+ *
+ * solve_wavefront() is one iteration step of the 2D-blocked solver, shared by
+ * solver-omp-gausseidel.c and solver-omp-redblack.c. Each thread computes a
+ * band of rows, in nblocksj blocks of columns (userparam blocks per thread,
+ * so that the wavefront fills up sooner with a higher userparam). In the
+ * Gauss-Seidel case (u == unew) the blocks are computed as a pipelined
+ * wavefront: a thread starts block blockj when the band above has finished
+ * it, which it learns from the progress counter of that band. Counters are
+ * padded to a cache line each and spinning threads yield the core after SPIN
+ * reads. When u != unew the step is Jacobi and the threads do not wait.
+ *
+ * Uses the lowerb(), upperb(), min() and max() macros and userparam, so it
+ * has to be included after their definitions.
+ */
+
+#include <stdlib.h>
+#include <sched.h>
+#include "omp.h"
+
+#define PAD 16          /* ints per cache line, each progress counter has its own line */
+#define SPIN 1000       /* reads of a counter before yielding the core */
+
+static double solve_wavefront (double *u, double *unew, unsigned sizex, unsigned sizey) {
+  double tmp, diff, sum=0.0;
+  int *progress;
+
+  #pragma omp parallel private(diff, tmp) reduction(+:sum)
+  {
+    int nblocksi = omp_get_num_threads();
+    int nblocksj = nblocksi * max(1, userparam);
+    #pragma omp single
+    progress = calloc(nblocksi * PAD, sizeof(int));
+
+    int blocki = omp_get_thread_num();
+    int i_start = lowerb(blocki, nblocksi, sizex);
+    int i_end = upperb(blocki, nblocksi, sizex);
+    for (int blockj=0; blockj<nblocksj; ++blockj) {
+      int j_start = lowerb(blockj, nblocksj, sizey);
+      int j_end = upperb(blockj, nblocksj, sizey);
+      if ((u == unew) && blocki != 0) {
+        int done, spins = 0;
+        for (;;) {
+          #pragma omp atomic read seq_cst
+          done = progress[(blocki-1) * PAD];
+          if (done > blockj) break;
+          if (++spins == SPIN) {
+            sched_yield();
+            spins = 0;
+          }
+        }
+      }
+      for (int i=max(1, i_start); i<=min(sizex-2, i_end); i++) {
+        for (int j=max(1, j_start); j<=min(sizey-2, j_end); j++) {
+          tmp = 0.25 * ( u[ i*sizey	   + (j-1) ] +  // left
+                           u[ i*sizey	   + (j+1) ] +  // right
+                           u[ (i-1)*sizey + j     ] +  // top
+                           u[ (i+1)*sizey + j     ] ); // bottom
+          diff = tmp - u[i*sizey+ j];
+          sum += diff * diff;
+          unew[i*sizey+j] = tmp;
+        }
+      }
+      if (u == unew) {
+        #pragma omp atomic write seq_cst
+        progress[blocki * PAD] = blockj + 1;
+      }
+    }
+  }
+  free(progress);
+  return sum;
+}
@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Benchmark driver for the Mandelbrot, multisort and heat programs
+
+Runs a program for every combination of thread counts and problem sizes,
+with warmup runs and repetitions, and reports for every time it measures
+the median, percentiles, speedup and parallel efficiency as CSV or JSON.
+
+The times are the ones recorded by par-timing.h (see par_timing_record()),
+so the programs have to be built from this tree. Programs that do not use
+par-timing.h (for instance the heat driver) can be measured with --regex,
+which takes the time from the first group of a regular expression matched
+on the standard output of the program.
+
+The string {size} in the command is replaced by the problem size, and
+OMP_NUM_THREADS is set to the thread count of each run. Examples:
+
+    # strong scaling of multisort on 1..8 threads
+    bench.py -t 1,2,4,8 -- ./multisort-cutoff -n 32768 -s 1024 -m 1024 -c 16
+
+    # weak scaling of mandel: the size per thread is kept (x4 pixels per x4 threads)
+    bench.py -t 1,4,16 -s 400 --weak --weak-exponent 0.5 -- ./mandel-omp-row-taskloop -w {size}
+
+    # heat, time printed by the driver
+    bench.py -t 1,2,4 --regex "Time: *([0-9.]+)" -- ./heat-omp test.dat
+
+With --baseline the medians are compared with the ones of a previous JSON
+report and the script exits with status 1 if any of them is more than
+--max-slowdown slower, so it can be run after every build.
+"""
+
+import argparse
+import csv
+import json
+import math
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+
+def percentile(values, p):
+    """Percentile p (0..100) of values, by linear interpolation"""
+    v = sorted(values)
+    if len(v) == 1:
+        return v[0]
+    x = (len(v) - 1) * p / 100.0
+    lo = int(math.floor(x))
+    hi = min(lo + 1, len(v) - 1)
+    return v[lo] + (v[hi] - v[lo]) * (x - lo)
+
+
+def run_once(command, threads, regex):
+    """Run command once with threads threads, returns {label: seconds}"""
+    env = dict(os.environ)
+    env["OMP_NUM_THREADS"] = str(threads)
+    fd, timing = tempfile.mkstemp(prefix="par-timing-", suffix=".tsv")
+    os.close(fd)
+    env["PAR_TIMING"] = timing
+    try:
+        proc = subprocess.run(command, env=env, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                              universal_newlines=True)
+        if proc.returncode != 0:
+            sys.stderr.write(proc.stderr)
+            raise RuntimeError("%s exited with status %d" % (" ".join(command), proc.returncode))
+        times = {}
+        with open(timing) as f:
+            for line in f:
+                label, _, seconds = line.rstrip("\n").rpartition("\t")
+                if label:
+                    times[label] = float(seconds)
+        if regex is not None:
+            m = regex.search(proc.stdout)
+            if m is None:
+                raise RuntimeError("no match for --regex in the output of %s" % " ".join(command))
+            times["regex"] = float(m.group(1))
+        return times
+    finally:
+        os.unlink(timing)
+
+
+def measure(command, threads, args, regex):
+    """Warmup runs and repetitions, returns {label: [seconds of each repetition]}"""
+    for _ in range(args.warmup):
+        run_once(command, threads, regex)
+    samples = {}
+    for _ in range(args.reps):
+        for label, seconds in run_once(command, threads, regex).items():
+            samples.setdefault(label, []).append(seconds)
+    return samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter,
+                                     epilog="\n".join(__doc__.split("\n")[2:]))
+    parser.add_argument("-t", "--threads", default="1", help="comma separated thread counts (default 1)")
+    parser.add_argument("-s", "--sizes", default=None, help="comma separated problem sizes for {size}")
+    parser.add_argument("--weak", action="store_true",
+                        help="weak scaling: size of each run is size * (threads/first threads)^weak-exponent")
+    parser.add_argument("--weak-exponent", type=float, default=1.0,
+                        help="exponent of the weak scaling (0.5 when size is the side of a square, default 1)")
+    parser.add_argument("-r", "--reps", type=int, default=5, help="measured repetitions (default 5)")
+    parser.add_argument("-w", "--warmup", type=int, default=1, help="warmup runs, not measured (default 1)")
+    parser.add_argument("--metric", action="append", default=None,
+                        help="only report this label (may be repeated, default all)")
+    parser.add_argument("--regex", default=None, help="take a time from the output with this regular expression")
+    parser.add_argument("-f", "--format", choices=("csv", "json"), default="csv")
+    parser.add_argument("-o", "--output", default=None, help="output file (default standard output)")
+    parser.add_argument("--baseline", default=None, help="JSON report to compare the medians with")
+    parser.add_argument("--max-slowdown", type=float, default=0.10,
+                        help="maximum slowdown with respect to the baseline (default 0.10, i.e. 10%%)")
+    parser.add_argument("command", nargs=argparse.REMAINDER, help="-- program and its arguments")
+    args = parser.parse_args()
+
+    command = args.command[1:] if args.command[:1] == ["--"] else args.command
+    if not command:
+        parser.error("no program to run")
+    threads = [int(t) for t in args.threads.split(",")]
+    sizes = [int(s) for s in args.sizes.split(",")] if args.sizes else [None]
+    regex = re.compile(args.regex) if args.regex else None
+    program = os.path.basename(command[0])
+
+    results = []
+    for size in sizes:
+        base = {}              # label -> median at the first thread count
+        for p in threads:
+            run_size = size
+            if size is not None and args.weak:
+                run_size = int(round(size * (p / threads[0]) ** args.weak_exponent))
+            cmd = [c.replace("{size}", str(run_size)) for c in command]
+            samples = measure(cmd, p, args, regex)
+            for label in sorted(samples):
+                if args.metric and label not in args.metric:
+                    continue
+                t = samples[label]
+                median = percentile(t, 50)
+                base.setdefault(label, median)
+                if args.weak:
+                    efficiency = base[label] / median
+                    speedup = efficiency * p / threads[0]
+                else:
+                    speedup = base[label] / median
+                    efficiency = speedup * threads[0] / p
+                results.append({
+                    "program": program, "label": label, "size": run_size, "threads": p,
+                    "reps": len(t), "median": median, "p10": percentile(t, 10), "p90": percentile(t, 90),
+                    "min": min(t), "max": max(t), "mean": sum(t) / len(t),
+                    "speedup": speedup, "efficiency": efficiency,
+                })
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    if args.format == "json":
+        json.dump({"command": command, "weak": args.weak, "results": results}, out, indent=2)
+        out.write("\n")
+    else:
+        fields = ["program", "label", "size", "threads", "reps", "median", "p10", "p90",
+                  "min", "max", "mean", "speedup", "efficiency"]
+        writer = csv.DictWriter(out, fieldnames=fields, lineterminator="\n")
+        writer.writeheader()
+        for r in results:
+            writer.writerow({k: ("%.6f" % v if isinstance(v, float) else v) for k, v in r.items()})
+    if out is not sys.stdout:
+        out.close()
+
+    status = 0
+    if args.baseline:
+        with open(args.baseline) as f:
+            previous = {(r["program"], r["label"], r["size"], r["threads"]): r["median"]
+                        for r in json.load(f)["results"]}
+        for r in results:
+            key = (r["program"], r["label"], r["size"], r["threads"])
+            if key in previous and r["median"] > previous[key] * (1 + args.max_slowdown):
+                sys.stderr.write("regression: %s '%s' size %s threads %d: %.6f s, baseline %.6f s\n"
+                                 % (key[0], key[1], key[2], key[3], r["median"], previous[key]))
+                status = 1
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,198 @@
+/*
+ * Instrumentation of tasks and phases for the PAR programs
+ *
+ * Compiled in with -DPAR_INSTRUMENT, otherwise all the macros do nothing
+ * (PAR_TASKWAIT is a plain taskwait) and the programs are the same as
+ * without them. When enabled, every thread keeps its own counters in
+ * its own cache lines: no atomics or locks are added to the parallel code.
+ * A summary is written to stderr at exit with, for every thread, the tasks
+ * it created and executed, the time it spent in them and the time it was
+ * idle at taskwait, the histogram of task durations, and for every phase
+ * its wall time, the load imbalance (maximum over average busy time of the
+ * threads) and the parallel efficiency (busy time over wall time times the
+ * number of threads).
+ *
+ *   PAR_TASK_CREATED;          before every #pragma omp task
+ *   PAR_TASK(stmt);            as the body of the task
+ *   PAR_TASKWAIT;              instead of #pragma omp taskwait
+ *   PAR_WORK_BEGIN; ... END;   around the work of a thread outside tasks (in
+ *                              a parallel region), counted as busy time
+ *   PAR_PHASE_BEGIN(name); ... PAR_PHASE_END;
+ *                              around a phase, outside parallel regions
+ *
+ * Times are exclusive: the tasks a thread executes while it waits in a
+ * taskwait, or inside another task, are not counted twice. The durations
+ * in the histogram include the time the task waited for its children.
+ *
+ * OMPT callbacks would get the same numbers without annotations, but
+ * libgomp (the runtime of GCC) does not implement OMPT, so the events are
+ * marked in the code. The state is static: include this file in a single
+ * translation unit of the program.
+ */
+
+#ifdef PAR_INSTRUMENT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "omp.h"
+
+#define PAR_MAX_THREADS 256
+#define PAR_MAX_DEPTH   256     // nesting of tasks and taskwaits per thread
+#define PAR_MAX_PHASES  16
+#define PAR_HIST_BINS   32      // bin 0: < 1 us, bin k: [2^(k-1), 2^k) us
+
+typedef struct {
+    double start, child;        // start time and time of the nested frames
+} par_frame;
+
+typedef struct {
+    long created, executed;
+    double busy, wait;
+    long hist[PAR_HIST_BINS];
+    int depth;
+    par_frame stack[PAR_MAX_DEPTH];
+} __attribute__ ((aligned (64))) par_thread;
+
+typedef struct {
+    const char *name;
+    long calls;
+    double wall, start;
+    double busy[PAR_MAX_THREADS], busy0[PAR_MAX_THREADS];
+} par_phase;
+
+static par_thread par_threads[PAR_MAX_THREADS];
+static par_phase par_phases[PAR_MAX_PHASES];
+static int par_nphases, par_current = -1;
+
+static inline double par_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + (double) t.tv_nsec * 1e-9;
+}
+
+static inline par_thread *par_self(void) {
+    return &par_threads[omp_get_thread_num() % PAR_MAX_THREADS];
+}
+
+static inline void par_frame_begin(void) {
+    par_thread *t = par_self();
+    if (t->depth < PAR_MAX_DEPTH) {
+        t->stack[t->depth].start = par_now();
+        t->stack[t->depth].child = 0.0;
+    }
+    t->depth++;
+}
+
+// Ends the innermost frame, returns its inclusive time and adds its
+// exclusive time to *exclusive
+static inline double par_frame_end(double *exclusive) {
+    par_thread *t = par_self();
+    if (--t->depth >= PAR_MAX_DEPTH) return 0.0;
+    double elapsed = par_now() - t->stack[t->depth].start;
+    *exclusive += elapsed - t->stack[t->depth].child;
+    if (t->depth > 0 && t->depth <= PAR_MAX_DEPTH) t->stack[t->depth-1].child += elapsed;
+    return elapsed;
+}
+
+static inline void par_task_end(void) {
+    par_thread *t = par_self();
+    double us = par_frame_end(&t->busy) * 1e6;
+    int bin = 0;
+    while (bin < PAR_HIST_BINS-1 && us >= 1.0) { us /= 2; bin++; }
+    t->hist[bin]++;
+    t->executed++;
+}
+
+static inline void par_wait_end(void) {
+    par_thread *t = par_self();
+    par_frame_end(&t->wait);
+}
+
+static inline void par_work_end(void) {
+    par_thread *t = par_self();
+    par_frame_end(&t->busy);
+}
+
+static void par_phase_begin(const char *name) {
+    int p;
+    for (p = 0; p < par_nphases && strcmp(par_phases[p].name, name) != 0; p++) ;
+    if (p == PAR_MAX_PHASES) return;
+    if (p == par_nphases) par_phases[par_nphases++].name = name;
+    par_current = p;
+    for (int t = 0; t < PAR_MAX_THREADS; t++) par_phases[p].busy0[t] = par_threads[t].busy;
+    par_phases[p].start = par_now();
+}
+
+static void par_phase_end(void) {
+    if (par_current < 0) return;
+    par_phase *ph = &par_phases[par_current];
+    ph->wall += par_now() - ph->start;
+    ph->calls++;
+    for (int t = 0; t < PAR_MAX_THREADS; t++) ph->busy[t] += par_threads[t].busy - ph->busy0[t];
+    par_current = -1;
+}
+
+static void par_report(void) {
+    int nthreads = 0;
+    for (int t = 0; t < PAR_MAX_THREADS; t++)
+        if (par_threads[t].executed || par_threads[t].created || par_threads[t].busy > 0) nthreads = t+1;
+    if (nthreads < omp_get_max_threads()) nthreads = omp_get_max_threads();
+
+    fprintf(stderr, "Instrumentation summary:\n");
+    fprintf(stderr, "  thread    created   executed    busy (s)  taskwait (s)\n");
+    long hist[PAR_HIST_BINS] = {0};
+    for (int t = 0; t < nthreads; t++) {
+        par_thread *th = &par_threads[t];
+        fprintf(stderr, "  %6d %10ld %10ld %11.6f %13.6f\n", t, th->created, th->executed, th->busy, th->wait);
+        for (int b = 0; b < PAR_HIST_BINS; b++) hist[b] += th->hist[b];
+    }
+
+    long tasks = 0;
+    for (int b = 0; b < PAR_HIST_BINS; b++) tasks += hist[b];
+    if (tasks > 0) fprintf(stderr, "  task durations:\n");
+    for (int b = 0; b < PAR_HIST_BINS; b++) {
+        if (hist[b] == 0) continue;
+        if (b == 0) fprintf(stderr, "    %17s %10ld\n", "< 1 us", hist[b]);
+        else fprintf(stderr, "    %7ld - %6ld us %10ld\n", 1L << (b-1), 1L << b, hist[b]);
+    }
+
+    if (par_nphases > 0)
+        fprintf(stderr, "  phase            calls    wall (s)    busy (s)  imbalance  efficiency\n");
+    for (int p = 0; p < par_nphases; p++) {
+        par_phase *ph = &par_phases[p];
+        double total = 0.0, max = 0.0;
+        for (int t = 0; t < nthreads; t++) {
+            total += ph->busy[t];
+            if (ph->busy[t] > max) max = ph->busy[t];
+        }
+        fprintf(stderr, "  %-14s %7ld %11.6f %11.6f %10.2f %11.2f\n", ph->name, ph->calls, ph->wall, total,
+                total > 0 ? max / (total / nthreads) : 0.0, ph->wall > 0 ? total / (ph->wall * nthreads) : 0.0);
+    }
+}
+
+static void __attribute__ ((constructor)) par_instrument_init(void) {
+    atexit(par_report);
+}
+
+#define PAR_PRAGMA(x)           _Pragma(#x)
+#define PAR_TASK_CREATED        (par_self()->created++)
+#define PAR_TASK(stmt)          { par_frame_begin(); stmt; par_task_end(); }
+#define PAR_TASKWAIT            { par_frame_begin(); PAR_PRAGMA(omp taskwait) par_wait_end(); }
+#define PAR_WORK_BEGIN          par_frame_begin()
+#define PAR_WORK_END            par_work_end()
+#define PAR_PHASE_BEGIN(name)   par_phase_begin(name)
+#define PAR_PHASE_END           par_phase_end()
+
+#else
+
+#define PAR_TASK_CREATED        ((void) 0)
+#define PAR_TASK(stmt)          { stmt; }
+#define PAR_TASKWAIT            _Pragma("omp taskwait")
+#define PAR_WORK_BEGIN          ((void) 0)
+#define PAR_WORK_END            ((void) 0)
+#define PAR_PHASE_BEGIN(name)   ((void) 0)
+#define PAR_PHASE_END           ((void) 0)
+
+#endif